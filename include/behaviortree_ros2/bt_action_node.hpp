@@ -15,7 +15,10 @@
 
 #pragma once
 
+#include <atomic>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <rclcpp/executors.hpp>
 #include <rclcpp/allocator/allocator_common.hpp>
@@ -24,6 +27,14 @@
 #include "rclcpp_action/rclcpp_action.hpp"
 
 #include "behaviortree_ros2/ros_node_params.hpp"
+#include "behaviortree_ros2/ros_entity_manager.hpp"
+#include "behaviortree_ros2/ros_client_registry.hpp"
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/ros_cancel_tracker.hpp"
+#include "behaviortree_ros2/message_mailbox.hpp"
+#include "behaviortree_ros2/ros_deadline.hpp"
+#include "behaviortree_ros2/ros_instrumentation.hpp"
+#include "behaviortree_ros2/ros_log_ring.hpp"
 
 namespace BT
 {
@@ -35,7 +46,8 @@ enum ActionNodeErrorCode
   GOAL_REJECTED_BY_SERVER,
   ACTION_ABORTED,
   ACTION_CANCELLED,
-  INVALID_GOAL
+  INVALID_GOAL,
+  RESULT_TIMEOUT
 };
 
 /**
@@ -55,6 +67,9 @@ enum ActionNodeErrorCode
  *
  * 1. If a value is passes in the InputPort "action_name", use that
  * 2. Otherwise, use the value in RosNodeParams::default_port_value
+ *
+ * With RosNodeParams::realtime, the callbacks of the client are executed by the
+ * background executor, and tick() doesn't allocate memory while the goal is RUNNING.
  */
 template<class ActionT>
 class RosActionNode : public BT::ActionNodeBase
@@ -65,6 +80,7 @@ public:
   using ActionType = ActionT;
   using ActionClient = typename rclcpp_action::Client<ActionT>;
   using ActionClientPtr = std::shared_ptr<ActionClient>;
+  using ClientInstance = RosClientInstance<ActionClient>;
   using Goal = typename ActionT::Goal;
   using GoalHandle = typename rclcpp_action::ClientGoalHandle<ActionT>;
   using WrappedResult = typename rclcpp_action::ClientGoalHandle<ActionT>::WrappedResult;
@@ -79,7 +95,7 @@ public:
                          const BT::NodeConfig& conf,
                          const RosNodeParams& params);
 
-  virtual ~RosActionNode() = default;
+  virtual ~RosActionNode();
 
   /**
    * @brief Any subclass of RosActionNode that has ports must implement a
@@ -108,12 +124,16 @@ public:
 
   NodeStatus tick() override final;
 
-  /// The default halt() implementation will call cancelGoal if necessary.
+  /// The default halt() implementation will call cancelGoal (or cancelGoalAsync, if
+  /// RosNodeParams::preempt_goals or RosNodeParams::cancel_tracker are set) if necessary.
   void halt() override;
 
   /** setGoal s a callback that allows the user to set
    *  the goal message (ActionT::Goal).
    *
+   * If RosNodeParams::reuse_requests is true, goal contains the values
+   * set in the previous invocation; otherwise it is default-constructed.
+   *
    * @param goal  the goal to be sent to the action server.
    *
    * @return false if the request should not be sent. In that case,
@@ -129,6 +149,11 @@ public:
   /** Callback invoked when the feedback is received.
    * It generally returns RUNNING, but the user can also use this callback to cancel the
    * current action and return SUCCESS or FAILURE.
+   *
+   * How often it is invoked depends on RosNodeParams::feedback_policy.
+   * With FeedbackPolicy::LATEST_ONLY or THROTTLED (and always when
+   * RosNodeParams::background_executor or cancel_tracker are used) it is invoked in tick(),
+   * with the latest feedback received since the previous invocation.
    */
   virtual BT::NodeStatus onFeedback(const std::shared_ptr<const Feedback> /*feedback*/)
   {
@@ -146,97 +171,233 @@ public:
   /// Method used to send a request to the Action server to cancel the current goal
   void cancelGoal();
 
+  /// Same as cancelGoal(), but it doesn't wait for the response of the server.
+  /// The request is registered in RosNodeParams::cancel_tracker, if set.
+  /// A goal that was not accepted yet is cancelled as soon as it is accepted.
+  void cancelGoalAsync();
+
 protected:
 
   std::shared_ptr<rclcpp::Node> node_;
   std::string prev_action_name_;
   bool action_name_may_change_ = false;
   const std::chrono::milliseconds server_timeout_;
+  const bool share_clients_;
+  const bool async_discovery_;
+  const bool preempt_goals_;
+  const std::shared_ptr<RosCancelTracker> cancel_tracker_;
+  const std::shared_ptr<RosBackgroundExecutor> background_executor_;
+  const bool reuse_requests_;
+  const FeedbackPolicy feedback_policy_;
+  const std::chrono::steady_clock::duration feedback_period_;
+  const std::chrono::milliseconds goal_accept_timeout_;
+  const std::chrono::milliseconds result_timeout_;
+  const std::chrono::milliseconds cancel_timeout_;
+  const std::shared_ptr<RosInstrumentation> instrumentation_;
+  const std::shared_ptr<RosLogRing> log_ring_;
+  const bool realtime_;
 
 private:
 
-  ActionClientPtr action_client_;
-  rclcpp::CallbackGroup::SharedPtr callback_group_;
-  rclcpp::executors::SingleThreadedExecutor callback_group_executor_;
-
+  std::shared_ptr<ClientInstance> client_instance_;
+  // clients used recently, when action_name_may_change_ is true
+  RosClientCache<ClientInstance> client_cache_;
+  CallbackGuard callback_guard_;
+  // discovery, goal acceptance or result timeout: only one is active at a time.
+  // It wakes up the tree when it expires.
+  RosDeadline deadline_;
+  // clock of deadline_
+  std::chrono::nanoseconds time_goal_sent_;
+
+  // written by the callbacks of the client, that might be executed by
+  // the background executor. Read in tick() when the flags are set.
+  std::mutex callback_mutex_;
+  std::atomic_bool result_ready_{false};
+  WrappedResult pending_result_;
+  // steady time when pending_result_ was received, if instrumentation_ is set
+  int64_t pending_result_time_ = 0;
+  RequestTimestamps timestamps_;
+  // registered in instrumentation_, if set
+  std::shared_ptr<RosNodeStats> stats_;
+
+  // latest feedback, when it is not processed in feedback_callback
+  using FeedbackSlot = std::pair<typename GoalHandle::SharedPtr, std::shared_ptr<const Feedback>>;
+  MessageMailbox<FeedbackSlot> pending_feedback_;
+  // FeedbackPolicy::THROTTLED: time (clock of feedback_wakeup_) when tick() processed the
+  // latest feedback. The same window is used by feedback_callback to decide whether
+  // to wake up the tree now, or when the window ends.
+  std::atomic<int64_t> feedback_processed_ns_{0};
+  // started by feedback_callback when a feedback is received inside the window
+  RosDeadline feedback_wakeup_;
+
+  Goal goal_;
   std::shared_future<typename GoalHandle::SharedPtr> future_goal_handle_;
   typename GoalHandle::SharedPtr goal_handle_;
 
-  rclcpp::Time time_goal_sent_;
+  // goals sent, but not accepted yet, when the Node was halted or timed out.
+  // They are cancelled by goal_response_callback as soon as they are accepted.
+  // Protected by callback_mutex_.
+  struct AbandonedGoal
+  {
+    std::shared_future<typename GoalHandle::SharedPtr> future;
+    std::weak_ptr<ClientInstance> instance;
+    std::string action_name;
+  };
+  std::vector<AbandonedGoal> abandoned_goals_;
+
   NodeStatus on_feedback_state_change_;
+  bool goal_sent_;
   bool goal_received_;
   WrappedResult result_;
+  // used only if RosNodeParams::lazy_entities is true
+  RosLazyEntity lazy_entity_;
+
+  // bound once, by the constructor
+  typename ActionClient::SendGoalOptions goal_options_;
+  RosLogThrottle log_throttle_;
+
+  // used when realtime_ is true and the name of the server is read from the blackboard:
+  // the entry is looked up once, and its value is copied only when it is written.
+  std::string action_name_key_;
+  std::shared_ptr<Blackboard::Entry> action_name_entry_;
+  uint64_t action_name_sequence_ = std::numeric_limits<uint64_t>::max();
+  std::string action_name_;
 
   bool createClient(const std::string &server_name);
+
+  // read the name of the server from the port and create the client, if it changed
+  void updateActionName();
+
+  void bindGoalOptions();
+
+  // send the cancel request without waiting for the response; it can be invoked by any thread
+  void sendCancelRequest(const std::shared_ptr<ClientInstance>& instance,
+                         const typename GoalHandle::SharedPtr& goal_handle,
+                         const std::string& action_name);
+
+  // the response to the current goal is not awaited anymore: cancel the goal once it is accepted
+  void abandonGoalRequest();
+
+  // cancel the abandoned goals that have been accepted; it can be invoked by any thread
+  void cancelAbandonedGoals();
 };
 
 //----------------------------------------------------------------
 //---------------------- DEFINITIONS -----------------------------
 //----------------------------------------------------------------
 
-template<class T> inline
+template<class T>
   RosActionNode<T>::RosActionNode(const std::string & instance_name,
                                   const NodeConfig &conf,
                                   const RosNodeParams &params):
   BT::ActionNodeBase(instance_name, conf),
   node_(params.nh),
-  server_timeout_(params.server_timeout)
+  server_timeout_(params.server_timeout),
+  share_clients_(params.share_clients),
+  async_discovery_(params.async_discovery),
+  preempt_goals_(params.preempt_goals),
+  cancel_tracker_(params.cancel_tracker),
+  background_executor_(params.background_executor),
+  reuse_requests_(params.reuse_requests || params.realtime),
+  feedback_policy_( ((params.background_executor || params.cancel_tracker) &&
+                     params.feedback_policy == FeedbackPolicy::EVERY_MESSAGE) ?
+                    FeedbackPolicy::LATEST_ONLY : params.feedback_policy ),
+  feedback_period_( std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                     std::chrono::duration<double>(params.feedback_rate > 0 ? 1.0 / params.feedback_rate : 0.0)) ),
+  goal_accept_timeout_(params.goal_accept_timeout.count() > 0 ? params.goal_accept_timeout : params.server_timeout),
+  result_timeout_(params.result_timeout),
+  cancel_timeout_(params.cancel_timeout.count() > 0 ? params.cancel_timeout : params.server_timeout),
+  instrumentation_(params.instrumentation),
+  log_ring_(params.log_ring),
+  realtime_(params.realtime),
+  client_cache_(params.client_cache_size),
+  deadline_(params.timeout_clock, params.nh->get_clock(),
+            [this, token = callback_guard_.token()]() {
+              auto lock = token.lock();
+              if(lock) {
+                emitWakeUpSignal();
+              }
+            }),
+  feedback_wakeup_(TimeoutClock::STEADY, nullptr,
+                   [this, token = callback_guard_.token()]() {
+                     auto lock = token.lock();
+                     if(lock) {
+                       emitWakeUpSignal();
+                     }
+                   })
 {
-  // Three cases:
-  // - we use the default action_name in RosNodeParams when port is empty
-  // - we use the action_name in the port and it is a static string.
-  // - we use the action_name in the port and it is blackboard entry.
-
   // Port must exist, even if empty, since we have a default value at least
-  if(!getInput<std::string>("server_name"))
+  if(config().manifest && config().manifest->ports.count("action_name") == 0)
   {
     throw std::logic_error(
-      "Can't find port [server_name]. "
+      "Can't find port [action_name]. "
       "Did you forget to use RosActionNode::providedBasicPorts() "
       "in your derived class?");
   }
-
-  // check port remapping
-  auto portIt = config().input_ports.find("action_name");
-  if(portIt != config().input_ports.end())
+  if(realtime_ && (!background_executor_ || !log_ring_))
+  {
+    throw std::logic_error(
+      "RosNodeParams::realtime requires both background_executor and log_ring");
+  }
+  if(instrumentation_)
   {
-    const std::string& bb_action_name = portIt->second;
+    stats_ = instrumentation_->registerNode(*this, "action");
+  }
 
-    if(bb_action_name.empty() || bb_action_name == "__default__placeholder__")
+  // a static name is known here; a blackboard entry is read in tick()
+  const std::string static_name = GetStaticPortName(*this, "action_name", params);
+  action_name_may_change_ = static_name.empty();
+  if(realtime_ && action_name_may_change_)
+  {
+    action_name_key_ = std::string(stripBlackboardPointer(config().input_ports.at("action_name")));
+    if(action_name_key_ == "=")
     {
-      if(params.default_port_value.empty()) {
-        throw std::logic_error(
-          "Both [action_name] in the InputPort and the RosNodeParams are empty.");
-      }
-      else {
-        createClient(params.default_port_value);
-      }
+      action_name_key_ = "action_name";
     }
-    else if(!isBlackboardPointer(bb_action_name))
+  }
+  bindGoalOptions();
+
+  if(!params.lazy_entities)
+  {
+    if(!static_name.empty())
     {
-      // If the content of the port "action_name" is not
-      // a pointer to the blackboard, but a static string, we can
-      // create the client in the constructor.
-      createClient(bb_action_name);
-    }
-    else {
-      action_name_may_change_ = true;
-      // createClient will be invoked in the first tick().
+      createClient(static_name);
     }
   }
   else {
-
-    if(params.default_port_value.empty()) {
-      throw std::logic_error(
-        "Both [action_name] in the InputPort and the RosNodeParams are empty.");
-    }
-    else {
-      createClient(params.default_port_value);
-    }
+    lazy_entity_.enable(params.entity_manager, this,
+      [this, static_name]() {
+        if(!static_name.empty())
+        {
+          createClient(static_name);
+        }
+      },
+      [this]() {
+        if(status() != NodeStatus::IDLE)
+        {
+          return false;
+        }
+        future_goal_handle_ = {};
+        goal_handle_ = {};
+        client_instance_.reset();
+        client_cache_.clear();
+        prev_action_name_.clear();
+        return true;
+      });
   }
 }
 
-template<class T> inline
+template<class T>
+  RosActionNode<T>::~RosActionNode()
+{
+  // the client must not be created by another thread anymore
+  lazy_entity_.disable();
+  // wait for the callback being executed by the background executor, if any,
+  // and make sure that no other callback will access this object.
+  callback_guard_.release();
+}
+
+template<class T>
   bool RosActionNode<T>::createClient(const std::string& action_name)
 {
   if(action_name.empty())
@@ -244,28 +405,56 @@ template<class T> inline
     throw RuntimeError("action_name is empty");
   }
 
-  callback_group_ = node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
-  callback_group_executor_.add_callback_group(callback_group_, node_->get_node_base_interface());
-  action_client_ = rclcpp_action::create_client<T>(node_, action_name, callback_group_);
+  auto create_client = [this, &action_name](rclcpp::CallbackGroup::SharedPtr group) {
+    return rclcpp_action::create_client<T>(node_, action_name, group);
+  };
+  client_instance_ = client_cache_.find(action_name);
+  if(!client_instance_)
+  {
+    if(share_clients_)
+    {
+      client_instance_ = RosClientRegistry::instance().get<ActionClient>(
+        node_, action_name, background_executor_, create_client);
+    }
+    else {
+      client_instance_ = createClientInstance<ActionClient>(node_, background_executor_, create_client);
+    }
+    client_cache_.insert(action_name, client_instance_);
+  }
 
   prev_action_name_ = action_name;
+  if(stats_)
+  {
+    stats_->setServerName(action_name);
+  }
 
-  bool found = action_client_->wait_for_action_server(server_timeout_);
+  if(async_discovery_)
+  {
+    // availability of the server will be checked in tick()
+    return client_instance_->isServerReady();
+  }
+
+  bool found = client_instance_->client->wait_for_action_server(server_timeout_);
   if(!found)
   {
     RCLCPP_ERROR(node_->get_logger(), "%s: Action server with name '%s' is not reachable.",
                  name().c_str(), prev_action_name_.c_str());
+    if(stats_)
+    {
+      stats_->increment(RosNodeStats::UNREACHABLE);
+    }
+  }
+  if(stats_)
+  {
+    stats_->setServerReachable(found);
   }
   return found;
 }
 
-template<class T> inline
-  NodeStatus RosActionNode<T>::tick()
+template<class T>
+  void RosActionNode<T>::updateActionName()
 {
-  // First, check if the action_client_ is valid and that the name of the
-  // action_name in the port didn't change.
-  // otherwise, create a new client
-  if(!action_client_ || (status() == NodeStatus::IDLE && action_name_may_change_))
+  if(!realtime_ || !action_name_may_change_)
   {
     std::string action_name;
     getInput("action_name", action_name);
@@ -273,15 +462,155 @@ template<class T> inline
     {
       createClient(action_name);
     }
+    return;
+  }
+  if(!action_name_entry_)
+  {
+    action_name_entry_ = config().blackboard->getEntry(action_name_key_);
+  }
+  if(action_name_entry_)
+  {
+    std::unique_lock lk(action_name_entry_->entry_mutex);
+    if(action_name_entry_->sequence_id != action_name_sequence_)
+    {
+      action_name_sequence_ = action_name_entry_->sequence_id;
+      const auto& value = action_name_entry_->value;
+      action_name_ = value.empty() ? std::string() : value.template cast<std::string>();
+    }
+  }
+  if(prev_action_name_ != action_name_)
+  {
+    createClient(action_name_);
+  }
+}
+
+template<class T>
+  void RosActionNode<T>::bindGoalOptions()
+{
+  //--------------------
+  goal_options_.feedback_callback =
+    [this, token = callback_guard_.token()](typename GoalHandle::SharedPtr handle,
+                                            const std::shared_ptr<const Feedback> feedback)
+  {
+    auto lock = token.lock();
+    if(!lock) {
+      return;
+    }
+    if(instrumentation_) {
+      RequestTimestamps::markFirst(timestamps_.first_feedback);
+    }
+    if(feedback_policy_ == FeedbackPolicy::EVERY_MESSAGE)
+    {
+      on_feedback_state_change_ = onFeedback(feedback);
+      if( on_feedback_state_change_ == NodeStatus::IDLE)
+      {
+        throw std::logic_error("onFeedback must not return IDLE");
+      }
+      emitWakeUpSignal();
+      return;
+    }
+    // onFeedback() will be invoked by tick(). Wake up the tree only if the
+    // previous feedback was consumed already. When throttled, a feedback received
+    // before the end of the window of tick() wakes up the tree when the window ends.
+    bool already_pending = false;
+    pending_feedback_.push( FeedbackSlot(handle, feedback), &already_pending );
+
+    if(feedback_policy_ == FeedbackPolicy::THROTTLED)
+    {
+      const auto window_end = std::chrono::nanoseconds(feedback_processed_ns_.load()) + feedback_period_;
+      if(feedback_wakeup_.now() < window_end)
+      {
+        // not restarted if the same wakeup is pending already
+        if(!feedback_wakeup_.isActive() || feedback_wakeup_.hasExpired() ||
+           feedback_wakeup_.expiration() != window_end)
+        {
+          feedback_wakeup_.startAt(window_end);
+        }
+        return;
+      }
+    }
+    if(!already_pending)
+    {
+      emitWakeUpSignal();
+    }
+  };
+  //--------------------
+  goal_options_.result_callback =
+    [this, token = callback_guard_.token()](const WrappedResult& result)
+  {
+    auto lock = token.lock();
+    if(!lock) {
+      return;
+    }
+    if(log_ring_) {
+      log_ring_->log(log_throttle_, RCUTILS_LOG_SEVERITY_DEBUG, node_->get_logger().get_name(),
+                     "result_callback");
+    }
+    else {
+      RCLCPP_DEBUG( node_->get_logger(), "result_callback" );
+    }
+    {
+      std::unique_lock lk(callback_mutex_);
+      pending_result_ = result;
+      pending_result_time_ = instrumentation_ ? RequestTimestamps::now() : 0;
+      result_ready_ = true;
+    }
+    emitWakeUpSignal();
+  };
+  //--------------------
+  goal_options_.goal_response_callback =
+    [this, token = callback_guard_.token()](typename GoalHandle::SharedPtr const future_handle)
+  {
+    auto lock = token.lock();
+    if(!lock) {
+      return;
+    }
+    auto goal_handle_ = future_handle.get();
+    const int severity = goal_handle_ ? RCUTILS_LOG_SEVERITY_INFO : RCUTILS_LOG_SEVERITY_ERROR;
+    const char* text = goal_handle_ ? "Goal accepted by server, waiting for result" :
+                                      "Goal was rejected by server";
+    if(log_ring_) {
+      log_ring_->log(log_throttle_, severity, node_->get_logger().get_name(), "%s", text);
+    }
+    else if(goal_handle_) {
+      RCLCPP_INFO(node_->get_logger(), "%s", text);
+    }
+    else {
+      RCLCPP_ERROR(node_->get_logger(), "%s", text);
+    }
+    if(goal_handle_ && instrumentation_) {
+      RequestTimestamps::mark(timestamps_.accepted);
+    }
+    // the promise is set before this callback is invoked
+    cancelAbandonedGoals();
+    emitWakeUpSignal();
+  };
+}
+
+template<class T>
+  NodeStatus RosActionNode<T>::tick()
+{
+  const auto tick_scope = RosNodeStats::tickScope(stats_.get());
+  if(lazy_entity_.enabled())
+  {
+    lazy_entity_.use();
+  }
+  // First, check if the action client is valid and that the name of the
+  // action_name in the port didn't change.
+  // otherwise, create a new client
+  if(!client_instance_ || (status() == NodeStatus::IDLE && action_name_may_change_))
+  {
+    updateActionName();
   }
 
   //------------------------------------------
-  auto CheckStatus = [](NodeStatus status)
+  auto CheckStatus = [this](NodeStatus status)
   {
     if( !isStatusCompleted(status) )
     {
       throw std::logic_error("RosActionNode: the callback must return either SUCCESS of FAILURE");
     }
+    deadline_.cancel();
     return status;
   };
 
@@ -290,75 +619,102 @@ template<class T> inline
   {
     setStatus(NodeStatus::RUNNING);
 
+    goal_sent_ = false;
     goal_received_ = false;
     future_goal_handle_ = {};
+    goal_handle_ = {};
     on_feedback_state_change_ = NodeStatus::RUNNING;
     result_ = {};
-
-    Goal goal;
-
-    if( !setGoal(goal) )
     {
-      return CheckStatus( onFailure(INVALID_GOAL) );
+      std::unique_lock lk(callback_mutex_);
+      result_ready_ = false;
+      pending_result_ = {};
     }
+    pending_feedback_.clear();
+    feedback_processed_ns_ = 0;
+    feedback_wakeup_.cancel();
+    timestamps_.reset();
+    if(async_discovery_)
+    {
+      deadline_.start(server_timeout_);
+    }
+  }
 
-    typename ActionClient::SendGoalOptions goal_options;
-
-    //--------------------
-    goal_options.feedback_callback =
-      [this](typename GoalHandle::SharedPtr,
-             const std::shared_ptr<const Feedback> feedback)
+  // the goal is sent as soon as the server is available. If async_discovery_ is false,
+  // this happens in the first tick, since we already waited in createClient()
+  if (!goal_sent_)
+  {
+    if( async_discovery_ && !client_instance_->isServerReady() )
     {
-      on_feedback_state_change_ = onFeedback(feedback);
-      if( on_feedback_state_change_ == NodeStatus::IDLE)
+      if( deadline_.hasExpired() )
       {
-        throw std::logic_error("onFeedback must not return IDLE");
+        if(log_ring_) {
+          log_ring_->log(log_throttle_, RCUTILS_LOG_SEVERITY_ERROR, node_->get_logger().get_name(),
+                         "%s: Action server with name '%s' is not reachable.",
+                         name().c_str(), prev_action_name_.c_str());
+        }
+        else {
+          RCLCPP_ERROR(node_->get_logger(), "%s: Action server with name '%s' is not reachable.",
+                       name().c_str(), prev_action_name_.c_str());
+        }
+        if(stats_)
+        {
+          stats_->increment(RosNodeStats::UNREACHABLE);
+          stats_->setServerReachable(false);
+        }
+        return CheckStatus( onFailure(SERVER_UNREACHABLE) );
       }
-      emitWakeUpSignal();
-    };
-    //--------------------
-    goal_options.result_callback =
-      [this](const WrappedResult& result)
+      return NodeStatus::RUNNING;
+    }
+
+    if( !reuse_requests_ )
     {
-      RCLCPP_DEBUG( node_->get_logger(), "result_callback" );
-      result_ = result;
-      emitWakeUpSignal();
-    };
-    //--------------------
-    goal_options.goal_response_callback =
-      [this](typename GoalHandle::SharedPtr const future_handle)
+      goal_ = Goal();
+    }
+    if( !setGoal(goal_) )
     {
-      auto goal_handle_ = future_handle.get();
-      if (!goal_handle_)
-      {
-        RCLCPP_ERROR(node_->get_logger(), "Goal was rejected by server");
-      } else {
-        RCLCPP_INFO(node_->get_logger(), "Goal accepted by server, waiting for result");
-      }
-    };
-    //--------------------
+      return CheckStatus( onFailure(INVALID_GOAL) );
+    }
 
-    future_goal_handle_ = action_client_->async_send_goal( goal, goal_options );
-    time_goal_sent_ = node_->now();
+    if(instrumentation_) {
+      RequestTimestamps::mark(timestamps_.sent);
+    }
+    if(stats_)
+    {
+      stats_->increment(RosNodeStats::REQUESTS_SENT);
+      stats_->setServerReachable(true);
+    }
+    future_goal_handle_ = client_instance_->client->async_send_goal( goal_, goal_options_ );
+    time_goal_sent_ = deadline_.now();
+    deadline_.startAt(time_goal_sent_ + goal_accept_timeout_);
+    goal_sent_ = true;
 
     return NodeStatus::RUNNING;
   }
 
   if (status() == NodeStatus::RUNNING)
   {
-    callback_group_executor_.spin_some();
+    {
+      const auto spin_scope = RosNodeStats::spinScope(client_instance_->executor ? stats_.get() : nullptr);
+      client_instance_->spinSome();
+    }
 
     // FIRST case: check if the goal request has a timeout
     if( !goal_received_ )
     {
       auto nodelay = std::chrono::milliseconds(0);
-      auto timeout = rclcpp::Duration::from_seconds( double(server_timeout_.count()) / 1000);
 
-      auto ret = callback_group_executor_.spin_until_future_complete(future_goal_handle_, nodelay);
+      auto ret = client_instance_->spinUntilFutureComplete(future_goal_handle_, nodelay);
       if (ret != rclcpp::FutureReturnCode::SUCCESS)
       {
-        if( (node_->now() - time_goal_sent_) > timeout )
+        if( deadline_.hasExpired() )
         {
+          if(stats_)
+          {
+            stats_->increment(RosNodeStats::TIMEOUTS);
+          }
+          // the server might still accept the goal later
+          abandonGoalRequest();
           return CheckStatus( onFailure(SEND_GOAL_TIMEOUT) );
         }
         else{
@@ -368,6 +724,11 @@ template<class T> inline
       else
       {
         goal_received_ = true;
+        deadline_.cancel();
+        if( result_timeout_.count() > 0 )
+        {
+          deadline_.startAt(time_goal_sent_ + result_timeout_);
+        }
         goal_handle_ = future_goal_handle_.get();
         future_goal_handle_ = {};
 
@@ -377,15 +738,66 @@ template<class T> inline
       }
     }
 
+    // feedback stored by feedback_callback: only the latest one is processed
+    if( feedback_policy_ != FeedbackPolicy::EVERY_MESSAGE && pending_feedback_.hasNewValue() )
+    {
+      const auto now = feedback_wakeup_.now();
+      if( feedback_policy_ == FeedbackPolicy::LATEST_ONLY ||
+          now >= std::chrono::nanoseconds(feedback_processed_ns_.load()) + feedback_period_ )
+      {
+        feedback_processed_ns_ = now.count();
+        auto [handle, feedback] = pending_feedback_.take();
+        // ignore the feedback of a previous goal
+        if( feedback && handle == goal_handle_ )
+        {
+          on_feedback_state_change_ = onFeedback(feedback);
+          if( on_feedback_state_change_ == NodeStatus::IDLE)
+          {
+            throw std::logic_error("onFeedback must not return IDLE");
+          }
+        }
+      }
+    }
+
+    if( result_ready_ )
+    {
+      int64_t result_time = 0;
+      {
+        std::unique_lock lk(callback_mutex_);
+        result_ = std::move(pending_result_);
+        result_time = pending_result_time_;
+        pending_result_ = {};
+        result_ready_ = false;
+      }
+      // ignore the result of a previous goal, for instance one that was cancelled
+      if( result_.goal_id != goal_handle_->get_goal_id() )
+      {
+        result_ = {};
+      }
+      else {
+        timestamps_.received = result_time;
+      }
+    }
+
     // SECOND case: onFeedback requested a stop
     if( on_feedback_state_change_ != NodeStatus::RUNNING )
     {
-      cancelGoal();
+      if(preempt_goals_ || cancel_tracker_) {
+        cancelGoalAsync();
+      }
+      else {
+        cancelGoal();
+      }
       return on_feedback_state_change_;
     }
     // THIRD case: result received, requested a stop
     if( result_.code != rclcpp_action::ResultCode::UNKNOWN)
     {
+      if(instrumentation_)
+      {
+        RequestTimestamps::mark(timestamps_.consumed);
+        instrumentation_->recordGoal(prev_action_name_, timestamps_);
+      }
       if( result_.code == rclcpp_action::ResultCode::ABORTED )
       {
         return CheckStatus( onFailure( ACTION_ABORTED ) );
@@ -398,25 +810,68 @@ template<class T> inline
         return CheckStatus( onResultReceived( result_ ) );
       }
     }
+    // FOURTH case: RosNodeParams::result_timeout expired
+    if( goal_received_ && deadline_.hasExpired() )
+    {
+      if(stats_)
+      {
+        stats_->increment(RosNodeStats::TIMEOUTS);
+      }
+      if(preempt_goals_ || cancel_tracker_) {
+        cancelGoalAsync();
+      }
+      else {
+        cancelGoal();
+      }
+      return CheckStatus( onFailure( RESULT_TIMEOUT ) );
+    }
   }
   return NodeStatus::RUNNING;
 }
 
-template<class T> inline
+template<class T>
   void RosActionNode<T>::halt()
 {
   if( status() == NodeStatus::RUNNING )
   {
-    cancelGoal();
+    deadline_.cancel();
+    if(preempt_goals_ || cancel_tracker_) {
+      cancelGoalAsync();
+    }
+    else {
+      cancelGoal();
+    }
   }
 }
 
-template<class T> inline
+template<class T>
   void RosActionNode<T>::cancelGoal()
 {
-  auto future_cancel = action_client_->async_cancel_goal(goal_handle_);
+  // the goal might have been sent, but not accepted yet
+  if(!goal_handle_ && future_goal_handle_.valid())
+  {
+    if(client_instance_->spinUntilFutureComplete(future_goal_handle_, cancel_timeout_) ==
+       rclcpp::FutureReturnCode::SUCCESS)
+    {
+      goal_handle_ = future_goal_handle_.get();
+      future_goal_handle_ = {};
+    }
+    else {
+      abandonGoalRequest();
+    }
+  }
+  if(!goal_handle_)
+  {
+    // the goal was not sent, or it was rejected
+    return;
+  }
+  if(stats_)
+  {
+    stats_->increment(RosNodeStats::CANCELS);
+  }
+  auto future_cancel = client_instance_->client->async_cancel_goal(goal_handle_);
 
-  if (callback_group_executor_.spin_until_future_complete(future_cancel, server_timeout_) !=
+  if (client_instance_->spinUntilFutureComplete(future_cancel, cancel_timeout_) !=
       rclcpp::FutureReturnCode::SUCCESS)
   {
     RCLCPP_ERROR( node_->get_logger(), "Failed to cancel action server for [%s]",
@@ -424,8 +879,110 @@ template<class T> inline
   }
 }
 
+template<class T>
+  void RosActionNode<T>::cancelGoalAsync()
+{
+  // the goal might have been accepted, but not processed by tick() yet
+  if(!goal_handle_ && future_goal_handle_.valid())
+  {
+    if(future_goal_handle_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+      goal_handle_ = future_goal_handle_.get();
+      future_goal_handle_ = {};
+    }
+    else {
+      abandonGoalRequest();
+    }
+  }
+  if(!goal_handle_)
+  {
+    return;
+  }
+  // the result callback of the goal will be discarded by tick(),
+  // since it has a different goal_id
+  sendCancelRequest(client_instance_, goal_handle_, prev_action_name_);
+  goal_handle_.reset();
+}
+
+template<class T>
+  void RosActionNode<T>::sendCancelRequest(const std::shared_ptr<ClientInstance>& instance,
+                                           const typename GoalHandle::SharedPtr& goal_handle,
+                                           const std::string& action_name)
+{
+  if(stats_)
+  {
+    stats_->increment(RosNodeStats::CANCELS);
+  }
+  if(!cancel_tracker_)
+  {
+    instance->client->async_cancel_goal(goal_handle);
+    return;
+  }
+  std::weak_ptr<ClientInstance> weak_instance = instance;
+  auto spin = [weak_instance]() {
+    if(auto locked_instance = weak_instance.lock()) {
+      locked_instance->trySpinSome();
+    }
+  };
+  const uint64_t id = cancel_tracker_->add(action_name, cancel_timeout_, spin);
+
+  std::weak_ptr<RosCancelTracker> weak_tracker = cancel_tracker_;
+  auto on_response = [weak_tracker, id](typename ActionClient::CancelResponse::SharedPtr response) {
+    if(auto tracker = weak_tracker.lock()) {
+      // ERROR_GOAL_TERMINATED: the goal was completed before the request was processed
+      tracker->onResponse(id, response &&
+                          (response->return_code == ActionClient::CancelResponse::ERROR_NONE ||
+                           response->return_code == ActionClient::CancelResponse::ERROR_GOAL_TERMINATED));
+    }
+  };
+  instance->client->async_cancel_goal(goal_handle, on_response);
+}
 
+template<class T>
+  void RosActionNode<T>::abandonGoalRequest()
+{
+  if(!future_goal_handle_.valid())
+  {
+    return;
+  }
+  {
+    std::unique_lock lk(callback_mutex_);
+    abandoned_goals_.push_back({future_goal_handle_, client_instance_, prev_action_name_});
+  }
+  future_goal_handle_ = {};
+  // the response might have been received in the meantime
+  cancelAbandonedGoals();
+}
 
+template<class T>
+  void RosActionNode<T>::cancelAbandonedGoals()
+{
+  std::vector<AbandonedGoal> accepted;
+  {
+    std::unique_lock lk(callback_mutex_);
+    for(auto it = abandoned_goals_.begin(); it != abandoned_goals_.end(); )
+    {
+      if(it->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+      {
+        accepted.push_back(std::move(*it));
+        it = abandoned_goals_.erase(it);
+      }
+      else {
+        it++;
+      }
+    }
+  }
+  for(const auto& abandoned: accepted)
+  {
+    auto goal_handle = abandoned.future.get();
+    auto instance = abandoned.instance.lock();
+    // null if the goal was rejected
+    if(goal_handle && instance)
+    {
+      sendCancelRequest(instance, goal_handle, abandoned.action_name);
+    }
+  }
+}
 
 }  // namespace BT
 
@@ -0,0 +1,95 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <rclcpp/generic_publisher.hpp>
+#include "behaviortree_cpp/condition_node.h"
+#include "behaviortree_cpp/bt_factory.h"
+
+#include "behaviortree_ros2/ros_node_params.hpp"
+#include "behaviortree_ros2/ros_generic_message.hpp"
+
+namespace BT
+{
+
+/**
+ * @brief Abstract class to wrap a publisher of any type, based on rclcpp::GenericPublisher.
+ *
+ * The message is published as it is, without serialization: relaying a message
+ * received by RosGenericTopicSubNode costs only the handoff of its buffer.
+ *
+ * The type of the topic is read from the InputPort "topic_type". If it is empty,
+ * the type of the first message passed by setMessage() is used.
+ */
+class RosGenericTopicPubNode : public BT::ConditionNode
+{
+public:
+  RosGenericTopicPubNode(const std::string & instance_name,
+                         const BT::NodeConfig& conf,
+                         const RosNodeParams& params);
+
+  virtual ~RosGenericTopicPubNode() = default;
+
+  /**
+   * @brief Any subclass of RosGenericTopicPubNode that has additinal ports must provide a
+   * providedPorts method and call providedBasicPorts in it.
+   *
+   * @param addition Additional ports to add to BT port list
+   * @return PortsList Containing basic ports along with node-specific ports
+   */
+  static PortsList providedBasicPorts(PortsList addition)
+  {
+    PortsList basic = {
+      InputPort<std::string>("topic_name", "__default__placeholder__", "Topic name"),
+      InputPort<std::string>("topic_type", "", "Topic type, for instance std_msgs/msg/String. "
+                                               "If empty, the type of the first message is used")
+    };
+    basic.insert(addition.begin(), addition.end());
+    return basic;
+  }
+
+  static PortsList providedPorts()
+  {
+    return providedBasicPorts({});
+  }
+
+  NodeStatus tick() override final;
+
+  /**
+   * @brief setMessage is a callback invoked in tick to allow the user to pass
+   * the message to be published, for instance one received by RosGenericTopicSubNode
+   * or created with RosGenericMessage::fromMessage().
+   *
+   * @return  return false if anything is wrong and we must not send the message.
+   * the Condition will return FAILURE. It also fails if the type of msg is
+   * different from the type of the topic.
+   */
+  virtual bool setMessage(RosGenericMessage::SharedPtr& msg) = 0;
+
+protected:
+  std::shared_ptr<rclcpp::Node> node_;
+  std::string topic_name_;
+  std::string prev_topic_name_;
+  std::string topic_type_;
+  bool topic_name_may_change_ = false;
+
+private:
+  std::shared_ptr<rclcpp::GenericPublisher> publisher_;
+  const rclcpp::QoS qos_;
+};
+
+}  // namespace BT
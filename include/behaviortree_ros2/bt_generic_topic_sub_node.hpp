@@ -0,0 +1,115 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <rclcpp/event.hpp>
+#include <rclcpp/executors.hpp>
+#include <rclcpp/generic_subscription.hpp>
+#include "behaviortree_cpp/condition_node.h"
+#include "behaviortree_cpp/bt_factory.h"
+
+#include "behaviortree_ros2/ros_node_params.hpp"
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/message_mailbox.hpp"
+#include "behaviortree_ros2/ros_generic_message.hpp"
+
+namespace BT
+{
+
+/**
+ * @brief Abstract class to wrap a subscriber of any type, based on rclcpp::GenericSubscription.
+ *
+ * Messages are not deserialized: this is useful for Nodes that only forward a
+ * message or check that it exists. It can still be deserialized with RosGenericMessage::as().
+ *
+ * The type of the topic, for instance "std_msgs/msg/String", is read from
+ * the InputPort "topic_type". If it is empty, the type is discovered from the
+ * ROS graph: the subscriber is created in the first tick() when the topic was advertised.
+ *
+ * Unlike RosTopicSubNode, this class is not a template, and intra-process
+ * communication is not supported by rclcpp::GenericSubscription.
+ */
+class RosGenericTopicSubNode : public BT::ConditionNode
+{
+public:
+  RosGenericTopicSubNode(const std::string & instance_name,
+                         const BT::NodeConfig& conf,
+                         const RosNodeParams& params);
+
+  virtual ~RosGenericTopicSubNode();
+
+  /**
+   * @brief Any subclass of RosGenericTopicSubNode that accepts parameters must provide a
+   * providedPorts method and call providedBasicPorts in it.
+   * @param addition Additional ports to add to BT port list
+   * @return PortsList Containing basic ports along with node-specific ports
+   */
+  static PortsList providedBasicPorts(PortsList addition)
+  {
+    PortsList basic = {
+      InputPort<std::string>("topic_name", "__default__placeholder__", "Topic name"),
+      InputPort<std::string>("topic_type", "", "Topic type, for instance std_msgs/msg/String. "
+                                               "If empty, it is read from the ROS graph")
+    };
+    basic.insert(addition.begin(), addition.end());
+    return basic;
+  }
+
+  static PortsList providedPorts()
+  {
+    return providedBasicPorts({});
+  }
+
+  NodeStatus tick() override final;
+
+  /** Callback invoked in the tick. You must return either SUCCESS of FAILURE
+   *
+   * @param last_msg the latest message received since the last tick, as in
+   * RosTopicSubNode::onTick(). It is empty if nothing was received or if the type
+   * of the topic is not known yet.
+   */
+  virtual NodeStatus onTick(const RosGenericMessage::SharedPtr& last_msg) = 0;
+
+protected:
+  std::shared_ptr<rclcpp::Node> node_;
+  std::string topic_name_;
+  std::string prev_topic_name_;
+  bool topic_name_may_change_ = false;
+  const std::shared_ptr<RosBackgroundExecutor> background_executor_;
+
+private:
+  // shared by all the messages received
+  std::shared_ptr<const std::string> topic_type_;
+  std::shared_ptr<rclcpp::GenericSubscription> subscriber_;
+  MessageMailbox<RosGenericMessage::SharedPtr> last_msg_;
+  const rclcpp::QoS qos_;
+  rclcpp::CallbackGroup::SharedPtr callback_group_;
+  // null when background_executor_ is used
+  std::unique_ptr<rclcpp::executors::SingleThreadedExecutor> callback_group_executor_;
+  CallbackGuard callback_guard_;
+  // while the type of the topic is discovered: the ROS graph is queried
+  // again only after graph_event_ was triggered
+  rclcpp::Event::SharedPtr graph_event_;
+  std::string undiscovered_topic_;
+
+  void removeCallbackGroup();
+
+  // false if the type of the topic is not known yet
+  bool createSubscriber(const std::string& topic_name);
+};
+
+}  // namespace BT
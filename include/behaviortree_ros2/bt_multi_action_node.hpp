@@ -0,0 +1,801 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "behaviortree_cpp/action_node.h"
+#include "behaviortree_cpp/bt_factory.h"
+#include "rclcpp_action/rclcpp_action.hpp"
+
+#include "behaviortree_ros2/bt_action_node.hpp"
+
+namespace BT
+{
+
+/**
+ * @brief Send the same type of goal to multiple action servers at once,
+ * for instance one for each robot of a fleet.
+ *
+ * The names of the servers are read from the port "action_names", separated by ';'
+ * (or from RosNodeParams::default_port_value, if the port is empty).
+ * All the goals are sent in the first tick and tracked by this single Node.
+ *
+ * Each goal completes with SUCCESS or FAILURE, as decided by onResultReceived()
+ * and onFailure(). Similarly to BT::ParallelNode, this Node returns:
+ *
+ * - SUCCESS when at least "success_count" goals succeeded;
+ * - FAILURE when at least "failure_count" goals failed, or when the
+ *   success threshold can't be reached anymore.
+ *
+ * Negative thresholds are relative to the number of goals: -1 means "all of them".
+ * The timeouts of RosNodeParams are measured from the first tick, for all the goals:
+ * goal_accept_timeout (preceded by server_timeout, with async_discovery) and result_timeout.
+ * The goals still running when the result is decided, or when the Node is halted,
+ * are cancelled without waiting for the response of the servers, as with
+ * RosNodeParams::preempt_goals (RosNodeParams::cancel_tracker is used, if set).
+ *
+ * Clients are shared with the other wrappers when RosNodeParams::share_clients is true.
+ * All the callbacks, and the expiration of the timeout, wake up the tree through
+ * the same path; when RosNodeParams::background_executor is used, a tick that
+ * follows no event returns immediately.
+ */
+template<class ActionT>
+class RosMultiActionNode : public BT::ActionNodeBase
+{
+
+public:
+  // Type definitions
+  using ActionType = ActionT;
+  using ActionClient = typename rclcpp_action::Client<ActionT>;
+  using ClientInstance = RosClientInstance<ActionClient>;
+  using Goal = typename ActionT::Goal;
+  using GoalHandle = typename rclcpp_action::ClientGoalHandle<ActionT>;
+  using WrappedResult = typename rclcpp_action::ClientGoalHandle<ActionT>::WrappedResult;
+  using Feedback = typename ActionT::Feedback;
+
+  /** To register this class into the factory, use:
+   *
+   *    factory.registerNodeType<>(node_name, params);
+   *
+   */
+  explicit RosMultiActionNode(const std::string & instance_name,
+                              const BT::NodeConfig& conf,
+                              const RosNodeParams& params);
+
+  virtual ~RosMultiActionNode();
+
+  /**
+   * @brief Any subclass of RosMultiActionNode that has ports must implement a
+   * providedPorts method and call providedBasicPorts in it.
+   *
+   * @param addition Additional ports to add to BT port list
+   * @return PortsList containing basic ports along with node-specific ports
+   */
+  static PortsList providedBasicPorts(PortsList addition)
+  {
+    PortsList basic = {
+      InputPort<std::string>("action_names", "__default__placeholder__",
+                             "Action server names, separated by ';'"),
+      InputPort<int>("success_count", -1,
+                     "number of goals that must succeed to return SUCCESS. -1 means all of them"),
+      InputPort<int>("failure_count", 1,
+                     "number of goals that must fail to return FAILURE. -1 means all of them")
+    };
+    basic.insert(addition.begin(), addition.end());
+    return basic;
+  }
+
+  /**
+   * @brief Creates list of BT ports
+   * @return PortsList Containing basic ports along with node-specific ports
+   */
+  static PortsList providedPorts()
+  {
+    return providedBasicPorts({});
+  }
+
+  NodeStatus tick() override final;
+
+  /// Cancel all the goals that are still running.
+  void halt() override;
+
+  /** setGoal is a callback that allows the user to set
+   *  the goal message sent to each server.
+   *
+   * If RosNodeParams::reuse_requests is true, goal contains the values
+   * set in the previous invocation; otherwise it is default-constructed.
+   *
+   * @param index        position of the server in the list "action_names".
+   * @param action_name  name of the server.
+   * @param goal         the goal to be sent to the action server.
+   *
+   * @return false if the request should not be sent. In that case,
+   * onFailure(index, INVALID_GOAL) will be called.
+   */
+  virtual bool setGoal(size_t index, const std::string& action_name, Goal& goal) = 0;
+
+  /** Callback invoked when the result of a goal is received.
+   * It must return SUCCESS or FAILURE; the default implementation returns SUCCESS.
+   */
+  virtual BT::NodeStatus onResultReceived(size_t /*index*/, const WrappedResult& /*result*/)
+  {
+    return NodeStatus::SUCCESS;
+  }
+
+  /** Callback invoked, in tick(), with the latest feedback of a goal.
+   * It generally returns RUNNING, but the user can also cancel that goal
+   * and complete it with SUCCESS or FAILURE.
+   */
+  virtual BT::NodeStatus onFeedback(size_t /*index*/, const std::shared_ptr<const Feedback> /*feedback*/)
+  {
+    return NodeStatus::RUNNING;
+  }
+
+  /** Callback invoked when something goes wrong with a goal.
+   * It must return either SUCCESS or FAILURE.
+   */
+  virtual BT::NodeStatus onFailure(size_t /*index*/, ActionNodeErrorCode /*error*/)
+  {
+    return NodeStatus::FAILURE;
+  }
+
+  /// Names of the servers, in the same order used by the callbacks.
+  const std::vector<std::string>& actionNames() const
+  {
+    return action_names_;
+  }
+
+protected:
+
+  std::shared_ptr<rclcpp::Node> node_;
+  std::string prev_action_names_;
+  bool action_names_may_change_ = false;
+  const std::chrono::milliseconds server_timeout_;
+  const bool share_clients_;
+  const bool async_discovery_;
+  const std::shared_ptr<RosCancelTracker> cancel_tracker_;
+  const std::shared_ptr<RosBackgroundExecutor> background_executor_;
+  const bool reuse_requests_;
+  const std::chrono::milliseconds goal_accept_timeout_;
+  const std::chrono::milliseconds result_timeout_;
+  const std::chrono::milliseconds cancel_timeout_;
+
+private:
+
+  using FeedbackSlot = std::pair<typename GoalHandle::SharedPtr, std::shared_ptr<const Feedback>>;
+
+  struct GoalState
+  {
+    std::shared_ptr<ClientInstance> client_instance;
+    Goal goal;
+    std::shared_future<typename GoalHandle::SharedPtr> future_goal_handle;
+    typename GoalHandle::SharedPtr goal_handle;
+    bool goal_sent = false;
+    bool goal_received = false;
+    NodeStatus status = NodeStatus::IDLE;
+
+    // written by the callbacks of the client, protected by the callback_mutex_ of the Node
+    bool result_ready = false;
+    WrappedResult pending_result;
+    MessageMailbox<FeedbackSlot> pending_feedback;
+  };
+
+  std::vector<std::string> action_names_;
+  // the callbacks hold weak references: a goal of a previous list of servers
+  // can't access the new state
+  std::vector<std::shared_ptr<GoalState>> goals_;
+  // unique instances, spun in tick()
+  std::vector<ClientInstance*> spin_instances_;
+  // clients used recently, when action_names_may_change_ is true
+  RosClientCache<ClientInstance> client_cache_;
+  CallbackGuard callback_guard_;
+  // started with the earliest of accept_deadline_ and result_deadline_
+  RosDeadline deadline_;
+  // clock of deadline_. Measured since the first tick, for all the goals.
+  std::chrono::nanoseconds accept_deadline_;
+  std::chrono::nanoseconds result_deadline_;
+
+  std::mutex callback_mutex_;
+
+  // goals sent, but not accepted yet, when they were cancelled.
+  // They are cancelled by goal_response_callback as soon as they are accepted.
+  // Protected by callback_mutex_.
+  struct AbandonedGoal
+  {
+    std::shared_future<typename GoalHandle::SharedPtr> future;
+    std::weak_ptr<ClientInstance> instance;
+    std::string action_name;
+  };
+  std::vector<AbandonedGoal> abandoned_goals_;
+
+  // incremented by every callback, before waking up the tree
+  std::atomic<uint64_t> events_{0};
+  uint64_t processed_events_ = 0;
+  // false while waiting for the discovery of a server
+  bool all_goals_sent_ = false;
+
+  size_t required_successes_ = 0;
+  size_t required_failures_ = 0;
+  size_t successes_ = 0;
+  size_t failures_ = 0;
+
+  void createClients(const std::string& action_names);
+
+  void notify();
+
+  void completeGoal(size_t index, NodeStatus status);
+
+  void cancelGoal(size_t index);
+
+  void sendGoal(size_t index);
+
+  void cancelRunningGoals();
+
+  // send the cancel request without waiting for the response; it can be invoked by any thread
+  void sendCancelRequest(const std::shared_ptr<ClientInstance>& instance,
+                         const typename GoalHandle::SharedPtr& goal_handle,
+                         const std::string& action_name);
+
+  // cancel the abandoned goals that have been accepted; it can be invoked by any thread
+  void cancelAbandonedGoals();
+};
+
+//----------------------------------------------------------------
+//---------------------- DEFINITIONS -----------------------------
+//----------------------------------------------------------------
+
+template<class T>
+  RosMultiActionNode<T>::RosMultiActionNode(const std::string & instance_name,
+                                            const NodeConfig &conf,
+                                            const RosNodeParams &params):
+  BT::ActionNodeBase(instance_name, conf),
+  node_(params.nh),
+  server_timeout_(params.server_timeout),
+  share_clients_(params.share_clients),
+  async_discovery_(params.async_discovery),
+  cancel_tracker_(params.cancel_tracker),
+  background_executor_(params.background_executor),
+  reuse_requests_(params.reuse_requests),
+  goal_accept_timeout_(params.goal_accept_timeout.count() > 0 ? params.goal_accept_timeout : params.server_timeout),
+  result_timeout_(params.result_timeout),
+  cancel_timeout_(params.cancel_timeout.count() > 0 ? params.cancel_timeout : params.server_timeout),
+  client_cache_(params.client_cache_size),
+  deadline_(params.timeout_clock, params.nh->get_clock(), [this, token = callback_guard_.token()]() {
+    auto lock = token.lock();
+    if(lock) {
+      notify();
+    }
+  })
+{
+  // a static name is known here; a blackboard entry is read in tick()
+  const std::string static_name = GetStaticPortName(*this, "action_names", params);
+  action_names_may_change_ = static_name.empty();
+  if(!static_name.empty())
+  {
+    createClients(static_name);
+  }
+}
+
+template<class T>
+  RosMultiActionNode<T>::~RosMultiActionNode()
+{
+  callback_guard_.release();
+}
+
+template<class T>
+  void RosMultiActionNode<T>::createClients(const std::string& action_names)
+{
+  std::vector<std::string> names;
+  for(const auto& part: splitString(action_names, ';'))
+  {
+    const auto first = part.find_first_not_of(' ');
+    if(first == StringView::npos) {
+      continue;
+    }
+    const auto last = part.find_last_not_of(' ');
+    names.emplace_back(part.substr(first, last - first + 1));
+  }
+  if(names.empty())
+  {
+    throw RuntimeError("action_names is empty");
+  }
+
+  goals_.clear();
+  spin_instances_.clear();
+  for(const auto& action_name: names)
+  {
+    auto create_client = [this, &action_name](rclcpp::CallbackGroup::SharedPtr group) {
+      return rclcpp_action::create_client<T>(node_, action_name, group);
+    };
+    auto state = std::make_shared<GoalState>();
+    state->client_instance = client_cache_.find(action_name);
+    if(!state->client_instance)
+    {
+      if(share_clients_)
+      {
+        state->client_instance = RosClientRegistry::instance().get<ActionClient>(
+          node_, action_name, background_executor_, create_client);
+      }
+      else {
+        state->client_instance = createClientInstance<ActionClient>(node_, background_executor_, create_client);
+      }
+      client_cache_.insert(action_name, state->client_instance);
+    }
+    // the same server might appear more than once
+    if(std::find(spin_instances_.begin(), spin_instances_.end(),
+                 state->client_instance.get()) == spin_instances_.end())
+    {
+      spin_instances_.push_back(state->client_instance.get());
+    }
+    goals_.push_back(std::move(state));
+  }
+  action_names_ = std::move(names);
+  prev_action_names_ = action_names;
+
+  if(async_discovery_)
+  {
+    // availability of the servers will be checked in tick()
+    return;
+  }
+  // wait for all the servers at the same time: the timeout is not
+  // multiplied by the number of servers
+  const auto deadline = std::chrono::steady_clock::now() + server_timeout_;
+  for(size_t i = 0; i < goals_.size(); i++)
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      deadline - std::chrono::steady_clock::now());
+    if(!goals_[i]->client_instance->client->wait_for_action_server(
+         std::max(remaining, std::chrono::nanoseconds(0))))
+    {
+      RCLCPP_ERROR(node_->get_logger(), "%s: Action server with name '%s' is not reachable.",
+                   name().c_str(), action_names_[i].c_str());
+    }
+  }
+}
+
+template<class T>
+  void RosMultiActionNode<T>::notify()
+{
+  events_.fetch_add(1, std::memory_order_release);
+  emitWakeUpSignal();
+}
+
+template<class T>
+  void RosMultiActionNode<T>::completeGoal(size_t index, NodeStatus status)
+{
+  if( !isStatusCompleted(status) )
+  {
+    throw std::logic_error("RosMultiActionNode: the callback must return either SUCCESS of FAILURE");
+  }
+  auto& state = *goals_[index];
+  if( state.status != NodeStatus::RUNNING )
+  {
+    return;
+  }
+  state.status = status;
+  if(status == NodeStatus::SUCCESS) {
+    successes_++;
+  }
+  else {
+    failures_++;
+  }
+}
+
+template<class T>
+  void RosMultiActionNode<T>::sendGoal(size_t index)
+{
+  auto& state = *goals_[index];
+
+  if( !reuse_requests_ )
+  {
+    state.goal = Goal();
+  }
+  if( !setGoal(index, action_names_[index], state.goal) )
+  {
+    completeGoal(index, onFailure(index, INVALID_GOAL));
+    return;
+  }
+
+  std::weak_ptr<GoalState> weak_state = goals_[index];
+  typename ActionClient::SendGoalOptions goal_options;
+
+  goal_options.feedback_callback =
+    [this, weak_state, token = callback_guard_.token()](typename GoalHandle::SharedPtr handle,
+                                                        const std::shared_ptr<const Feedback> feedback)
+  {
+    auto lock = token.lock();
+    auto locked_state = weak_state.lock();
+    if(!lock || !locked_state) {
+      return;
+    }
+    // wake up the tree only if the previous feedback was consumed already
+    bool already_pending = false;
+    locked_state->pending_feedback.push( FeedbackSlot(handle, feedback), &already_pending );
+    if(!already_pending) {
+      notify();
+    }
+  };
+  goal_options.result_callback =
+    [this, weak_state, token = callback_guard_.token()](const WrappedResult& result)
+  {
+    auto lock = token.lock();
+    auto locked_state = weak_state.lock();
+    if(!lock || !locked_state) {
+      return;
+    }
+    {
+      std::unique_lock lk(callback_mutex_);
+      locked_state->pending_result = result;
+      locked_state->result_ready = true;
+    }
+    notify();
+  };
+  goal_options.goal_response_callback =
+    [this, token = callback_guard_.token()](typename GoalHandle::SharedPtr const)
+  {
+    auto lock = token.lock();
+    if(lock) {
+      cancelAbandonedGoals();
+      notify();
+    }
+  };
+
+  state.future_goal_handle = state.client_instance->client->async_send_goal( state.goal, goal_options );
+  state.goal_sent = true;
+}
+
+template<class T>
+  NodeStatus RosMultiActionNode<T>::tick()
+{
+  if(goals_.empty() || (status() == NodeStatus::IDLE && action_names_may_change_))
+  {
+    std::string action_names;
+    getInput("action_names", action_names);
+    if(prev_action_names_ != action_names)
+    {
+      createClients(action_names);
+    }
+  }
+
+  const size_t num_goals = goals_.size();
+
+  // first step to be done only at the beginning of the Action
+  if (status() == BT::NodeStatus::IDLE)
+  {
+    setStatus(NodeStatus::RUNNING);
+
+    auto threshold = [num_goals, this](const char* port, int default_value) -> size_t
+    {
+      int value = default_value;
+      getInput(port, value);
+      const int count = (value < 0) ? int(num_goals) + value + 1 : value;
+      if(count <= 0 || count > int(num_goals))
+      {
+        throw RuntimeError("RosMultiActionNode: invalid ", port,
+                           ", the number of servers is ", std::to_string(num_goals));
+      }
+      return size_t(count);
+    };
+    required_successes_ = threshold("success_count", -1);
+    required_failures_ = threshold("failure_count", 1);
+    successes_ = 0;
+    failures_ = 0;
+
+    {
+      std::unique_lock lk(callback_mutex_);
+      for(auto& state: goals_)
+      {
+        state->future_goal_handle = {};
+        state->goal_handle = {};
+        state->goal_sent = false;
+        state->goal_received = false;
+        state->status = NodeStatus::RUNNING;
+        state->result_ready = false;
+        state->pending_result = {};
+        state->pending_feedback.clear();
+      }
+    }
+    all_goals_sent_ = false;
+    const auto now = deadline_.now();
+    // with async_discovery, the servers must be discovered first
+    accept_deadline_ = now + goal_accept_timeout_ +
+                       (async_discovery_ ? server_timeout_ : std::chrono::milliseconds(0));
+    result_deadline_ = (result_timeout_.count() > 0) ? now + result_timeout_ :
+                                                       std::chrono::nanoseconds::max();
+    deadline_.startAt(std::min(accept_deadline_, result_deadline_));
+    processed_events_ = events_.load(std::memory_order_acquire);
+  }
+  else if( background_executor_ && all_goals_sent_ )
+  {
+    // nothing happened since the previous tick; the expiration of deadline_ is an event too
+    const uint64_t events = events_.load(std::memory_order_acquire);
+    const bool idle_tick = (events == processed_events_);
+    processed_events_ = events;
+    if( idle_tick )
+    {
+      return NodeStatus::RUNNING;
+    }
+  }
+
+  for(auto* instance: spin_instances_)
+  {
+    instance->spinSome();
+  }
+
+  const bool timeout_expired = deadline_.hasReached(accept_deadline_);
+  const bool result_expired = deadline_.hasReached(result_deadline_);
+  bool all_goals_sent = true;
+  bool all_goals_accepted = true;
+
+  for(size_t i = 0; i < num_goals; i++)
+  {
+    auto& state = *goals_[i];
+    if(state.status != NodeStatus::RUNNING)
+    {
+      continue;
+    }
+
+    // the goal is sent as soon as the server is available
+    if( !state.goal_sent )
+    {
+      if( async_discovery_ && !state.client_instance->isServerReady() )
+      {
+        if( timeout_expired )
+        {
+          RCLCPP_ERROR(node_->get_logger(), "%s: Action server with name '%s' is not reachable.",
+                       name().c_str(), action_names_[i].c_str());
+          completeGoal(i, onFailure(i, SERVER_UNREACHABLE));
+        }
+        else {
+          all_goals_sent = false;
+          all_goals_accepted = false;
+        }
+        continue;
+      }
+      sendGoal(i);
+      all_goals_accepted = false;
+      continue;
+    }
+
+    if( !state.goal_received )
+    {
+      if( state.future_goal_handle.wait_for(std::chrono::seconds(0)) != std::future_status::ready )
+      {
+        if( timeout_expired )
+        {
+          // the goal is cancelled if it is accepted later
+          cancelGoal(i);
+          completeGoal(i, onFailure(i, SEND_GOAL_TIMEOUT));
+        }
+        else {
+          all_goals_accepted = false;
+        }
+        continue;
+      }
+      state.goal_received = true;
+      state.goal_handle = state.future_goal_handle.get();
+      state.future_goal_handle = {};
+      if( !state.goal_handle )
+      {
+        RCLCPP_ERROR(node_->get_logger(), "%s: Goal was rejected by server '%s'",
+                     name().c_str(), action_names_[i].c_str());
+        completeGoal(i, onFailure(i, GOAL_REJECTED_BY_SERVER));
+        continue;
+      }
+    }
+
+    if( state.pending_feedback.hasNewValue() )
+    {
+      auto [handle, feedback] = state.pending_feedback.take();
+      // ignore the feedback of a previous goal
+      if( feedback && handle == state.goal_handle )
+      {
+        const NodeStatus feedback_status = onFeedback(i, feedback);
+        if( feedback_status == NodeStatus::IDLE)
+        {
+          throw std::logic_error("onFeedback must not return IDLE");
+        }
+        if( feedback_status != NodeStatus::RUNNING )
+        {
+          cancelGoal(i);
+          completeGoal(i, feedback_status);
+          continue;
+        }
+      }
+    }
+
+    bool result_ready = false;
+    WrappedResult result;
+    {
+      std::unique_lock lk(callback_mutex_);
+      if( state.result_ready ) {
+        result = std::move(state.pending_result);
+        state.pending_result = {};
+        state.result_ready = false;
+        result_ready = true;
+      }
+    }
+    // ignore the result of a previous goal, for instance one that was cancelled
+    if( result_ready && result.goal_id == state.goal_handle->get_goal_id() )
+    {
+      state.goal_handle.reset();
+      if( result.code == rclcpp_action::ResultCode::ABORTED )
+      {
+        completeGoal(i, onFailure(i, ACTION_ABORTED));
+      }
+      else if( result.code == rclcpp_action::ResultCode::CANCELED )
+      {
+        completeGoal(i, onFailure(i, ACTION_CANCELLED));
+      }
+      else {
+        completeGoal(i, onResultReceived(i, result));
+      }
+    }
+    else if( result_expired )
+    {
+      cancelGoal(i);
+      completeGoal(i, onFailure(i, RESULT_TIMEOUT));
+    }
+  }
+
+  all_goals_sent_ = all_goals_sent;
+  // once all the goals are accepted, only the result timeout is left
+  const auto next_deadline = all_goals_accepted ? result_deadline_ :
+                                                  std::min(accept_deadline_, result_deadline_);
+  if( next_deadline == std::chrono::nanoseconds::max() )
+  {
+    // the following ticks are driven by the callbacks
+    deadline_.cancel();
+  }
+  else if( !deadline_.isActive() || deadline_.expiration() != next_deadline )
+  {
+    deadline_.startAt(next_deadline);
+  }
+
+  if( successes_ >= required_successes_ )
+  {
+    cancelRunningGoals();
+    return NodeStatus::SUCCESS;
+  }
+  if( failures_ >= required_failures_ || failures_ > num_goals - required_successes_ )
+  {
+    cancelRunningGoals();
+    return NodeStatus::FAILURE;
+  }
+  return NodeStatus::RUNNING;
+}
+
+template<class T>
+  void RosMultiActionNode<T>::halt()
+{
+  if( status() == NodeStatus::RUNNING )
+  {
+    cancelRunningGoals();
+    resetStatus();
+  }
+}
+
+template<class T>
+  void RosMultiActionNode<T>::cancelRunningGoals()
+{
+  deadline_.cancel();
+  for(size_t i = 0; i < goals_.size(); i++)
+  {
+    if(goals_[i]->status == NodeStatus::RUNNING)
+    {
+      cancelGoal(i);
+      goals_[i]->status = NodeStatus::IDLE;
+    }
+  }
+}
+
+template<class T>
+  void RosMultiActionNode<T>::cancelGoal(size_t index)
+{
+  auto& state = *goals_[index];
+  // the goal might have been accepted, but not processed by tick() yet
+  if(!state.goal_handle && state.future_goal_handle.valid() &&
+     state.future_goal_handle.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+  {
+    state.goal_handle = state.future_goal_handle.get();
+    state.future_goal_handle = {};
+  }
+  if(state.future_goal_handle.valid())
+  {
+    // not accepted yet: cancel it as soon as it is accepted
+    {
+      std::unique_lock lk(callback_mutex_);
+      abandoned_goals_.push_back({state.future_goal_handle, state.client_instance, action_names_[index]});
+    }
+    state.future_goal_handle = {};
+    // the response might have been received in the meantime
+    cancelAbandonedGoals();
+    return;
+  }
+  state.future_goal_handle = {};
+  if(!state.goal_handle)
+  {
+    return;
+  }
+  sendCancelRequest(state.client_instance, state.goal_handle, action_names_[index]);
+  state.goal_handle.reset();
+}
+
+template<class T>
+  void RosMultiActionNode<T>::sendCancelRequest(const std::shared_ptr<ClientInstance>& instance,
+                                                const typename GoalHandle::SharedPtr& goal_handle,
+                                                const std::string& action_name)
+{
+  if(!cancel_tracker_)
+  {
+    instance->client->async_cancel_goal(goal_handle);
+    return;
+  }
+  std::weak_ptr<ClientInstance> weak_instance = instance;
+  auto spin = [weak_instance]() {
+    if(auto locked_instance = weak_instance.lock()) {
+      locked_instance->trySpinSome();
+    }
+  };
+  const uint64_t id = cancel_tracker_->add(action_name, cancel_timeout_, spin);
+
+  std::weak_ptr<RosCancelTracker> weak_tracker = cancel_tracker_;
+  auto on_response = [weak_tracker, id](typename ActionClient::CancelResponse::SharedPtr response) {
+    if(auto tracker = weak_tracker.lock()) {
+      // ERROR_GOAL_TERMINATED: the goal was completed before the request was processed
+      tracker->onResponse(id, response &&
+                          (response->return_code == ActionClient::CancelResponse::ERROR_NONE ||
+                           response->return_code == ActionClient::CancelResponse::ERROR_GOAL_TERMINATED));
+    }
+  };
+  instance->client->async_cancel_goal(goal_handle, on_response);
+}
+
+template<class T>
+  void RosMultiActionNode<T>::cancelAbandonedGoals()
+{
+  std::vector<AbandonedGoal> accepted;
+  {
+    std::unique_lock lk(callback_mutex_);
+    for(auto it = abandoned_goals_.begin(); it != abandoned_goals_.end(); )
+    {
+      if(it->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+      {
+        accepted.push_back(std::move(*it));
+        it = abandoned_goals_.erase(it);
+      }
+      else {
+        it++;
+      }
+    }
+  }
+  for(const auto& abandoned: accepted)
+  {
+    auto goal_handle = abandoned.future.get();
+    auto instance = abandoned.instance.lock();
+    // null if the goal was rejected
+    if(goal_handle && instance)
+    {
+      sendCancelRequest(instance, goal_handle, abandoned.action_name);
+    }
+  }
+}
+
+}  // namespace BT
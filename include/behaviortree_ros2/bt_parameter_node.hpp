@@ -0,0 +1,74 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <rcl_interfaces/srv/get_parameters.hpp>
+
+#include "behaviortree_ros2/bt_service_node.hpp"
+#include "behaviortree_ros2/ros_parameter_cache.hpp"
+
+namespace BT
+{
+
+/**
+ * @brief Read a parameter of a remote node and write it into the blackboard.
+ *
+ * The value is taken from RosParameterCache; only on a cache miss it is requested
+ * with the service GetParameters, whose name is read from the InputPort "service_name",
+ * or from RosNodeParams::default_port_value, for instance "/controller_server/get_parameters".
+ *
+ * The value is written into the OutputPort "value", with the C++ type that corresponds
+ * to its ROS type: bool, int64_t, double, std::string or a std::vector of them
+ * (std::vector<uint8_t> for byte arrays).
+ *
+ * It returns SUCCESS if the parameter is set, FAILURE otherwise.
+ */
+class RosParameterNode : public ROS::RosServiceNode<rcl_interfaces::srv::GetParameters>
+{
+public:
+  explicit RosParameterNode(const std::string & instance_name,
+                            const BT::NodeConfig& conf,
+                            const BT::RosNodeParams& params);
+
+  static PortsList providedPorts()
+  {
+    return providedBasicPorts({
+      InputPort<std::string>("parameter", "Name of the parameter"),
+      OutputPort<AnyTypeAllowed>("value", "Value of the parameter")
+    });
+  }
+
+  NodeStatus onStart() override;
+
+  bool setRequest(Request::SharedPtr& request) override;
+
+  NodeStatus onResponseReceived(const Response::SharedPtr& response) override;
+
+protected:
+  const std::shared_ptr<RosParameterCache> cache_;
+
+private:
+  std::string parameter_;
+  // fully qualified name of the remote node, derived from the name of the service
+  std::string remote_node_;
+  std::string remote_service_;
+
+  NodeStatus writeValue(const rcl_interfaces::msg::ParameterValue& value);
+};
+
+}  // namespace BT
@@ -0,0 +1,103 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <std_msgs/msg/bool.hpp>
+#include <std_msgs/msg/empty.hpp>
+#include <std_msgs/msg/float64.hpp>
+#include <std_msgs/msg/int32.hpp>
+#include <std_msgs/msg/string.hpp>
+#include <geometry_msgs/msg/point.hpp>
+#include <geometry_msgs/msg/pose.hpp>
+#include <geometry_msgs/msg/pose_stamped.hpp>
+#include <geometry_msgs/msg/twist.hpp>
+#include <geometry_msgs/msg/twist_stamped.hpp>
+#include <std_srvs/srv/empty.hpp>
+#include <std_srvs/srv/set_bool.hpp>
+#include <std_srvs/srv/trigger.hpp>
+#include "behaviortree_ros2/action/sleep.hpp"
+
+#include "behaviortree_ros2/bt_action_node.hpp"
+#include "behaviortree_ros2/bt_multi_action_node.hpp"
+#include "behaviortree_ros2/bt_service_node.hpp"
+#include "behaviortree_ros2/bt_service_batch_node.hpp"
+#include "behaviortree_ros2/bt_topic_sub_node.hpp"
+#include "behaviortree_ros2/bt_topic_pub_node.hpp"
+
+/**
+ * The wrappers of the interfaces listed below are compiled once, in libbt_ros2.
+ * Including this header, instead of the headers of the single wrappers,
+ * a plugin that uses them doesn't instantiate them again: this reduces both
+ * the compilation time and the size of the binaries, since the plugin
+ * resolves them in the shared libbt_ros2 at load time.
+ *
+ * The same can be done for other interfaces, in a shared library used by
+ * many plugins (a static one would be copied into each of them):
+ *
+ *   // in a header
+ *   BT_ROS2_EXTERN_ACTION(nav2_msgs::action::NavigateToPose)
+ *   // in a single source file
+ *   BT_ROS2_INSTANTIATE_ACTION(nav2_msgs::action::NavigateToPose)
+ */
+
+#define BT_ROS2_FOR_EACH_TOPIC_TYPE(X) \
+  X(std_msgs::msg::Bool) \
+  X(std_msgs::msg::Empty) \
+  X(std_msgs::msg::Float64) \
+  X(std_msgs::msg::Int32) \
+  X(std_msgs::msg::String) \
+  X(geometry_msgs::msg::Point) \
+  X(geometry_msgs::msg::Pose) \
+  X(geometry_msgs::msg::PoseStamped) \
+  X(geometry_msgs::msg::Twist) \
+  X(geometry_msgs::msg::TwistStamped)
+
+#define BT_ROS2_FOR_EACH_SERVICE_TYPE(X) \
+  X(std_srvs::srv::Empty) \
+  X(std_srvs::srv::SetBool) \
+  X(std_srvs::srv::Trigger)
+
+#define BT_ROS2_FOR_EACH_ACTION_TYPE(X) \
+  X(behaviortree_ros2::action::Sleep)
+
+#define BT_ROS2_EXTERN_TOPIC(TopicT) \
+  extern template class BT::RosTopicSubNode<TopicT>; \
+  extern template class BT::RosTopicPubNode<TopicT>;
+
+#define BT_ROS2_EXTERN_SERVICE(ServiceT) \
+  extern template class BT::ROS::RosServiceNode<ServiceT>; \
+  extern template class BT::ROS::RosServiceBatchNode<ServiceT>;
+
+#define BT_ROS2_EXTERN_ACTION(ActionT) \
+  extern template class BT::RosActionNode<ActionT>; \
+  extern template class BT::RosMultiActionNode<ActionT>;
+
+#define BT_ROS2_INSTANTIATE_TOPIC(TopicT) \
+  template class BT::RosTopicSubNode<TopicT>; \
+  template class BT::RosTopicPubNode<TopicT>;
+
+#define BT_ROS2_INSTANTIATE_SERVICE(ServiceT) \
+  template class BT::ROS::RosServiceNode<ServiceT>; \
+  template class BT::ROS::RosServiceBatchNode<ServiceT>;
+
+#define BT_ROS2_INSTANTIATE_ACTION(ActionT) \
+  template class BT::RosActionNode<ActionT>; \
+  template class BT::RosMultiActionNode<ActionT>;
+
+#ifndef BT_ROS2_INSTANTIATIONS_SOURCE
+BT_ROS2_FOR_EACH_TOPIC_TYPE(BT_ROS2_EXTERN_TOPIC)
+BT_ROS2_FOR_EACH_SERVICE_TYPE(BT_ROS2_EXTERN_SERVICE)
+BT_ROS2_FOR_EACH_ACTION_TYPE(BT_ROS2_EXTERN_ACTION)
+#endif
@@ -0,0 +1,395 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "behaviortree_cpp/bt_factory.h"
+
+#include "behaviortree_ros2/bt_service_node.hpp"
+
+namespace BT::ROS
+{
+
+/**
+ * @brief Variant of RosServiceNode that sends a batch of requests,
+ * keeping up to "max_in_flight" of them pending at the same time.
+ *
+ * The Node returns RUNNING until all the responses are received; they are
+ * passed to onResponsesReceived() in the same order as the requests.
+ * If any request times out (RosNodeParams::server_timeout, measured since it was sent
+ * with RosNodeParams::timeout_clock),
+ * the remaining ones are dropped and onFailure(SERVICE_TIMEOUT) is invoked.
+ *
+ * The requests are read from the port "requests" (a blackboard entry of type
+ * RequestBatch) or provided by overriding setRequests().
+ */
+template<class ServiceT>
+class RosServiceBatchNode : public BT::ActionNodeBase
+{
+
+public:
+  // Type definitions
+  using ServiceClient = typename rclcpp::Client<ServiceT>;
+  using ClientInstance = RosClientInstance<ServiceClient>;
+  using Request = typename ServiceT::Request;
+  using Response = typename ServiceT::Response;
+  using RequestBatch = std::vector<typename Request::SharedPtr>;
+  using ResponseBatch = std::vector<typename Response::SharedPtr>;
+
+  /** To register this class into the factory, use:
+   *
+   *    factory.registerNodeType<>(node_name, params);
+   */
+  explicit RosServiceBatchNode(const std::string & instance_name,
+                               const BT::NodeConfig& conf,
+                               const BT::RosNodeParams& params);
+
+  virtual ~RosServiceBatchNode();
+
+  /**
+   * @brief Any subclass of RosServiceBatchNode that has ports must implement a
+   * providedPorts method and call providedBasicPorts in it.
+   *
+   * @param addition Additional ports to add to BT port list
+   * @return PortsList containing basic ports along with node-specific ports
+   */
+  static PortsList providedBasicPorts(PortsList addition)
+  {
+    PortsList basic = {
+      InputPort<std::string>("service_name", "__default__placeholder__", "Service name"),
+      InputPort<RequestBatch>("requests", "Requests to send"),
+      InputPort<unsigned>("max_in_flight", 8, "Maximum number of pending requests")
+    };
+    basic.insert(addition.begin(), addition.end());
+    return basic;
+  }
+
+  /**
+   * @brief Creates list of BT ports
+   * @return PortsList Containing basic ports along with node-specific ports
+   */
+  static PortsList providedPorts()
+  {
+    return providedBasicPorts({});
+  }
+
+  NodeStatus tick() override final;
+
+  /// The pending requests are dropped.
+  void halt() override;
+
+  /** setRequests is a callback that allows the user to set the requests to send.
+   * The default implementation reads them from the port "requests".
+   *
+   * @return false if the requests should not be sent. In that case,
+   * onFailure(INVALID_REQUEST) will be called.
+   */
+  virtual bool setRequests(RequestBatch& requests)
+  {
+    return static_cast<bool>(getInput("requests", requests));
+  }
+
+  /** Callback invoked when all the responses are received.
+   * It is up to the user to define if this returns SUCCESS or FAILURE.
+   *
+   * @param responses one response for each request, in the same order.
+   */
+  virtual BT::NodeStatus onResponsesReceived(const ResponseBatch& responses) = 0;
+
+  /** Callback invoked when something goes wrong; you can override it.
+   * It must return either SUCCESS or FAILURE.
+   */
+  virtual BT::NodeStatus onFailure(ServiceNodeErrorCode /*error*/)
+  {
+    return NodeStatus::FAILURE;
+  }
+
+protected:
+
+  std::shared_ptr<rclcpp::Node> node_;
+  std::string prev_service_name_;
+  bool service_name_may_change_ = false;
+  const std::chrono::milliseconds service_timeout_;
+  const bool share_clients_;
+  const bool async_discovery_;
+  const std::shared_ptr<RosBackgroundExecutor> background_executor_;
+
+private:
+
+  struct PendingRequest
+  {
+    size_t index;
+    int64_t request_id;
+    std::shared_future<typename Response::SharedPtr> future;
+    // time of the clock of deadline_
+    std::chrono::nanoseconds deadline;
+  };
+
+  std::shared_ptr<ClientInstance> client_instance_;
+  // clients used recently, when service_name_may_change_ is true
+  RosClientCache<ClientInstance> client_cache_;
+  CallbackGuard callback_guard_;
+  // discovery timeout, then the deadline of the oldest pending request
+  RosDeadline deadline_;
+
+  RequestBatch requests_;
+  ResponseBatch responses_;
+  std::vector<PendingRequest> in_flight_;
+  size_t max_in_flight_ = 1;
+  size_t next_request_ = 0;
+  size_t received_ = 0;
+
+  bool createClient(const std::string &service_name);
+
+  void removePendingRequests();
+};
+
+//----------------------------------------------------------------
+//---------------------- DEFINITIONS -----------------------------
+//----------------------------------------------------------------
+
+template<class T>
+  RosServiceBatchNode<T>::RosServiceBatchNode(const std::string & instance_name,
+                                              const NodeConfig &conf,
+                                              const RosNodeParams& params):
+  BT::ActionNodeBase(instance_name, conf),
+  node_(params.nh),
+  service_timeout_(params.server_timeout),
+  share_clients_(params.share_clients),
+  async_discovery_(params.async_discovery),
+  background_executor_(params.background_executor),
+  client_cache_(params.client_cache_size),
+  deadline_(params.timeout_clock, params.nh->get_clock(),
+            [this, token = callback_guard_.token()]() {
+              auto lock = token.lock();
+              if(lock) {
+                emitWakeUpSignal();
+              }
+            })
+{
+  // a static name is known here; a blackboard entry is read in tick()
+  const std::string static_name = GetStaticPortName(*this, "service_name", params);
+  service_name_may_change_ = static_name.empty();
+  if(!static_name.empty())
+  {
+    createClient(static_name);
+  }
+}
+
+template<class T>
+  RosServiceBatchNode<T>::~RosServiceBatchNode()
+{
+  callback_guard_.release();
+}
+
+template<class T>
+  bool RosServiceBatchNode<T>::createClient(const std::string& service_name)
+{
+  if(service_name.empty())
+  {
+    throw RuntimeError("service_name is empty");
+  }
+
+  auto create_client = [this, &service_name](rclcpp::CallbackGroup::SharedPtr group) {
+    return node_->create_client<T>(service_name, rmw_qos_profile_services_default, group);
+  };
+  client_instance_ = client_cache_.find(service_name);
+  if(!client_instance_)
+  {
+    if(share_clients_)
+    {
+      client_instance_ = RosClientRegistry::instance().get<ServiceClient>(
+        node_, service_name, background_executor_, create_client);
+    }
+    else {
+      client_instance_ = createClientInstance<ServiceClient>(node_, background_executor_, create_client);
+    }
+    client_cache_.insert(service_name, client_instance_);
+  }
+  prev_service_name_ = service_name;
+
+  if(async_discovery_)
+  {
+    return client_instance_->isServerReady();
+  }
+
+  bool found = client_instance_->client->wait_for_service(service_timeout_);
+  if(!found)
+  {
+    RCLCPP_ERROR(node_->get_logger(), "%s: Service with name '%s' is not reachable.",
+                 name().c_str(), prev_service_name_.c_str());
+  }
+  return found;
+}
+
+template<class T>
+  void RosServiceBatchNode<T>::removePendingRequests()
+{
+  for(const auto& pending: in_flight_)
+  {
+    client_instance_->client->remove_pending_request(pending.request_id);
+  }
+  in_flight_.clear();
+}
+
+template<class T>
+  NodeStatus RosServiceBatchNode<T>::tick()
+{
+  if(!client_instance_ || (status() == NodeStatus::IDLE && service_name_may_change_))
+  {
+    std::string service_name;
+    getInput("service_name", service_name);
+    if(prev_service_name_ != service_name)
+    {
+      createClient(service_name);
+    }
+  }
+
+  auto CheckStatus = [this](NodeStatus status)
+  {
+    if( !isStatusCompleted(status) )
+    {
+      throw std::logic_error("RosServiceBatchNode: the callback must return either SUCCESS or FAILURE");
+    }
+    removePendingRequests();
+    deadline_.cancel();
+    requests_.clear();
+    responses_.clear();
+    return status;
+  };
+
+  // first step to be done only at the beginning of the Action
+  if (status() == BT::NodeStatus::IDLE)
+  {
+    setStatus(NodeStatus::RUNNING);
+
+    requests_.clear();
+    in_flight_.clear();
+    next_request_ = 0;
+    received_ = 0;
+
+    if( !setRequests(requests_) )
+    {
+      return CheckStatus( onFailure(INVALID_REQUEST) );
+    }
+    for(const auto& request: requests_)
+    {
+      if(!request) {
+        return CheckStatus( onFailure(INVALID_REQUEST) );
+      }
+    }
+    responses_.assign(requests_.size(), nullptr);
+
+    unsigned max_in_flight = 8;
+    getInput("max_in_flight", max_in_flight);
+    max_in_flight_ = std::max(1u, max_in_flight);
+    in_flight_.reserve(max_in_flight_);
+
+    if(async_discovery_)
+    {
+      deadline_.start(service_timeout_);
+    }
+  }
+
+  if( next_request_ == 0 && !requests_.empty() &&
+      async_discovery_ && !client_instance_->isServerReady() )
+  {
+    if( deadline_.hasExpired() )
+    {
+      RCLCPP_ERROR(node_->get_logger(), "%s: Service with name '%s' is not reachable.",
+                   name().c_str(), prev_service_name_.c_str());
+      return CheckStatus( onFailure(SERVICE_UNREACHABLE) );
+    }
+    return NodeStatus::RUNNING;
+  }
+
+  client_instance_->spinSome();
+
+  // collect the responses
+  for(size_t i = 0; i < in_flight_.size(); )
+  {
+    auto& pending = in_flight_[i];
+    if(pending.future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+      responses_[pending.index] = pending.future.get();
+      if (!responses_[pending.index]) {
+        throw std::runtime_error("Request was rejected by the service");
+      }
+      received_++;
+      // order of in_flight_ doesn't matter
+      std::swap(pending, in_flight_.back());
+      in_flight_.pop_back();
+    }
+    else if( deadline_.hasReached(pending.deadline) )
+    {
+      return CheckStatus( onFailure(SERVICE_TIMEOUT) );
+    }
+    else {
+      i++;
+    }
+  }
+
+  // fill the pipeline
+  const auto request_deadline = (in_flight_.size() < max_in_flight_ && next_request_ < requests_.size()) ?
+                                deadline_.now() + service_timeout_ : std::chrono::nanoseconds(0);
+  while( in_flight_.size() < max_in_flight_ && next_request_ < requests_.size() )
+  {
+    auto on_response = [this, token = callback_guard_.token()](typename ServiceClient::SharedFuture)
+    {
+      auto lock = token.lock();
+      if(lock) {
+        emitWakeUpSignal();
+      }
+    };
+    auto future_and_id = client_instance_->client->async_send_request(requests_[next_request_], on_response);
+    in_flight_.push_back( {next_request_, future_and_id.request_id, future_and_id.future, request_deadline} );
+    next_request_++;
+  }
+
+  // a single timer, that expires with the oldest pending request
+  if( !in_flight_.empty() )
+  {
+    auto oldest = in_flight_.front().deadline;
+    for(const auto& pending: in_flight_)
+    {
+      oldest = std::min(oldest, pending.deadline);
+    }
+    if( !deadline_.isActive() || deadline_.expiration() != oldest )
+    {
+      deadline_.startAt(oldest);
+    }
+  }
+
+  if( received_ == requests_.size() )
+  {
+    return CheckStatus( onResponsesReceived(responses_) );
+  }
+  return NodeStatus::RUNNING;
+}
+
+template<class T>
+  void RosServiceBatchNode<T>::halt()
+{
+  if( status() == NodeStatus::RUNNING )
+  {
+    removePendingRequests();
+    deadline_.cancel();
+    resetStatus();
+  }
+}
+
+}  // namespace BT::ROS
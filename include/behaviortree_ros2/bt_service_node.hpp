@@ -22,6 +22,11 @@
 #include "behaviortree_cpp/bt_factory.h"
 
 #include "behaviortree_ros2/ros_node_params.hpp"
+#include "behaviortree_ros2/ros_entity_manager.hpp"
+#include "behaviortree_ros2/ros_client_registry.hpp"
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/ros_deadline.hpp"
+#include "behaviortree_ros2/ros_instrumentation.hpp"
 
 namespace BT::ROS
 {
@@ -59,6 +64,7 @@ class RosServiceNode : public BT::ActionNodeBase
 public:
   // Type definitions
   using ServiceClient = typename rclcpp::Client<ServiceT>;
+  using ClientInstance = RosClientInstance<ServiceClient>;
   using Request = typename ServiceT::Request;
   using Response = typename ServiceT::Response;
 
@@ -70,7 +76,7 @@ public:
                           const BT::NodeConfig& conf,
                           const BT::RosNodeParams& params);
 
-  virtual ~RosServiceNode() = default;
+  virtual ~RosServiceNode();
 
   /**
    * @brief Any subclass of RosServiceNode that has ports must implement a
@@ -102,9 +108,24 @@ public:
   /// The default halt() implementation.
   void halt() override;
 
+  /** Callback invoked in the first tick, before the request is sent.
+   * If it returns SUCCESS or FAILURE, the request is not sent and the Node
+   * returns that status; this is useful when the response is known already,
+   * for instance because it was cached. The default implementation returns RUNNING.
+   */
+  virtual BT::NodeStatus onStart()
+  {
+    return NodeStatus::RUNNING;
+  }
+
   /** setRequest is a callback that allows the user to set
    * the request message (ServiceT::Request).
    *
+   * If RosNodeParams::reuse_requests is true, request is the object used in the
+   * previous request, instead of a new one, so that the memory of its strings and
+   * vectors is reused; it is a new object if you kept a reference to the previous one.
+   * Otherwise it is always a new object.
+   *
    * @param request  the request to be sent to the service provider.
    *
    * @return false if the request should not be sent. In that case,
@@ -131,76 +152,117 @@ protected:
   std::string prev_service_name_;
   bool service_name_may_change_ = false;
   const std::chrono::milliseconds service_timeout_;
+  const bool share_clients_;
+  const bool async_discovery_;
+  const std::shared_ptr<RosBackgroundExecutor> background_executor_;
+  const bool reuse_requests_;
+  const std::shared_ptr<RosInstrumentation> instrumentation_;
 
 private:
 
-  typename std::shared_ptr<ServiceClient> service_client_;
-  rclcpp::CallbackGroup::SharedPtr callback_group_;
-  rclcpp::executors::SingleThreadedExecutor callback_group_executor_;
+  // reused at each request when reuse_requests_ is true
+  typename Request::SharedPtr request_;
+
+  std::shared_ptr<ClientInstance> client_instance_;
+  // clients used recently, when service_name_may_change_ is true
+  RosClientCache<ClientInstance> client_cache_;
+  CallbackGuard callback_guard_;
+  // discovery and response timeout; it wakes up the tree when it expires
+  RosDeadline deadline_;
 
   std::shared_future<typename Response::SharedPtr> future_response_;
+  // id of the request of future_response_
+  int64_t request_id_ = 0;
+  RequestTimestamps timestamps_;
+  // registered in instrumentation_, if set
+  std::shared_ptr<RosNodeStats> stats_;
+  // used only if RosNodeParams::lazy_entities is true
+  RosLazyEntity lazy_entity_;
 
-  rclcpp::Time time_request_sent_;
   NodeStatus on_feedback_state_change_;
+  bool request_sent_;
   bool response_received_;
   typename Response::SharedPtr response_;
 
   bool createClient(const std::string &service_name);
+
+  // the response is not awaited anymore: remove the request from the client, that
+  // might be shared and outlive this Node, so that its pending requests don't grow
+  void removePendingRequest();
 };
 
 //----------------------------------------------------------------
 //---------------------- DEFINITIONS -----------------------------
 //----------------------------------------------------------------
 
-template<class T> inline
+template<class T>
   RosServiceNode<T>::RosServiceNode(const std::string & instance_name,
                                     const NodeConfig &conf,
                                     const RosNodeParams& params):
   BT::ActionNodeBase(instance_name, conf),
   node_(params.nh),
-  service_timeout_(params.server_timeout)
+  service_timeout_(params.server_timeout),
+  share_clients_(params.share_clients),
+  async_discovery_(params.async_discovery),
+  background_executor_(params.background_executor),
+  reuse_requests_(params.reuse_requests),
+  instrumentation_(params.instrumentation),
+  client_cache_(params.client_cache_size),
+  deadline_(params.timeout_clock, params.nh->get_clock(),
+            [this, token = callback_guard_.token()]() {
+              auto lock = token.lock();
+              if(lock) {
+                emitWakeUpSignal();
+              }
+            })
 {
-  // check port remapping
-  auto portIt = config().input_ports.find("service_name");
-  if(portIt != config().input_ports.end())
+  if(instrumentation_)
   {
-    const std::string& bb_service_name = portIt->second;
+    stats_ = instrumentation_->registerNode(*this, "service");
+  }
+  // a static name is known here; a blackboard entry is read in tick()
+  const std::string static_name = GetStaticPortName(*this, "service_name", params);
+  service_name_may_change_ = static_name.empty();
 
-    if(bb_service_name.empty() || bb_service_name == "__default__placeholder__")
-    {
-      if(params.default_port_value.empty()) {
-        throw std::logic_error(
-          "Both [service_name] in the InputPort and the RosNodeParams are empty.");
-      }
-      else {
-        createClient(params.default_port_value);
-      }
-    }
-    else if(!isBlackboardPointer(bb_service_name))
+  if(!params.lazy_entities)
+  {
+    if(!static_name.empty())
     {
-      // If the content of the port "service_name" is not
-      // a pointer to the blackboard, but a static string, we can
-      // create the client in the constructor.
-      createClient(bb_service_name);
-    }
-    else {
-      service_name_may_change_ = true;
-      // createClient will be invoked in the first tick().
+      createClient(static_name);
     }
   }
   else {
-
-    if(params.default_port_value.empty()) {
-      throw std::logic_error(
-        "Both [service_name] in the InputPort and the RosNodeParams are empty.");
-    }
-    else {
-      createClient(params.default_port_value);
-    }
+    lazy_entity_.enable(params.entity_manager, this,
+      [this, static_name]() {
+        if(!static_name.empty())
+        {
+          createClient(static_name);
+        }
+      },
+      [this]() {
+        if(status() != NodeStatus::IDLE)
+        {
+          return false;
+        }
+        removePendingRequest();
+        client_instance_.reset();
+        client_cache_.clear();
+        prev_service_name_.clear();
+        return true;
+      });
   }
 }
 
-template<class T> inline
+template<class T>
+  RosServiceNode<T>::~RosServiceNode()
+{
+  // the client must not be created by another thread anymore
+  lazy_entity_.disable();
+  // make sure that no callback executed by the background executor will access this object.
+  callback_guard_.release();
+}
+
+template<class T>
   bool RosServiceNode<T>::createClient(const std::string& service_name)
 {
   if(service_name.empty())
@@ -208,27 +270,63 @@ template<class T> inline
     throw RuntimeError("service_name is empty");
   }
 
-  callback_group_ = node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
-  callback_group_executor_.add_callback_group(callback_group_, node_->get_node_base_interface());
-  service_client_ = node_->create_client<T>(service_name, rmw_qos_profile_services_default, callback_group_);
+  auto create_client = [this, &service_name](rclcpp::CallbackGroup::SharedPtr group) {
+    return node_->create_client<T>(service_name, rmw_qos_profile_services_default, group);
+  };
+  client_instance_ = client_cache_.find(service_name);
+  if(!client_instance_)
+  {
+    if(share_clients_)
+    {
+      client_instance_ = RosClientRegistry::instance().get<ServiceClient>(
+        node_, service_name, background_executor_, create_client);
+    }
+    else {
+      client_instance_ = createClientInstance<ServiceClient>(node_, background_executor_, create_client);
+    }
+    client_cache_.insert(service_name, client_instance_);
+  }
   prev_service_name_ = service_name;
+  if(stats_)
+  {
+    stats_->setServerName(service_name);
+  }
+
+  if(async_discovery_)
+  {
+    // availability of the service will be checked in tick()
+    return client_instance_->isServerReady();
+  }
 
-  bool found = service_client_->wait_for_service(service_timeout_);
+  bool found = client_instance_->client->wait_for_service(service_timeout_);
   if(!found)
   {
     RCLCPP_ERROR(node_->get_logger(), "%s: Service with name '%s' is not reachable.",
                  name().c_str(), prev_service_name_.c_str());
+    if(stats_)
+    {
+      stats_->increment(RosNodeStats::UNREACHABLE);
+    }
+  }
+  if(stats_)
+  {
+    stats_->setServerReachable(found);
   }
   return found;
 }
 
-template<class T> inline
+template<class T>
   NodeStatus RosServiceNode<T>::tick()
 {
-  // First, check if the service_client_ is valid and that the name of the
+  const auto tick_scope = RosNodeStats::tickScope(stats_.get());
+  if(lazy_entity_.enabled())
+  {
+    lazy_entity_.use();
+  }
+  // First, check if the service client is valid and that the name of the
   // service_name in the port didn't change.
   // otherwise, create a new client
-  if(!service_client_ || (status() == NodeStatus::IDLE && service_name_may_change_))
+  if(!client_instance_ || (status() == NodeStatus::IDLE && service_name_may_change_))
   {
     std::string service_name;
     getInput("service_name", service_name);
@@ -238,54 +336,122 @@ template<class T> inline
     }
   }
 
-  auto CheckStatus = [](NodeStatus status)
+  auto CheckStatus = [this](NodeStatus status)
   {
     if( !isStatusCompleted(status) )
     {
       throw std::logic_error("RosServiceNode: the callback must return either SUCCESS or FAILURE");
     }
+    deadline_.cancel();
     return status;
   };
 
   // first step to be done only at the beginning of the Action
   if (status() == BT::NodeStatus::IDLE)
   {
+    const NodeStatus start_status = onStart();
+    if( start_status != NodeStatus::RUNNING )
+    {
+      return CheckStatus( start_status );
+    }
     setStatus(NodeStatus::RUNNING);
 
+    request_sent_ = false;
     response_received_ = false;
     future_response_ = {};
+    timestamps_.reset();
     on_feedback_state_change_ = NodeStatus::RUNNING;
     response_ = {};
+    if(async_discovery_)
+    {
+      deadline_.start(service_timeout_);
+    }
+  }
+
+  // the request is sent as soon as the service is available. If async_discovery_ is false,
+  // this happens in the first tick, since we already waited in createClient()
+  if (!request_sent_)
+  {
+    if( async_discovery_ && !client_instance_->isServerReady() )
+    {
+      if( deadline_.hasExpired() )
+      {
+        RCLCPP_ERROR(node_->get_logger(), "%s: Service with name '%s' is not reachable.",
+                     name().c_str(), prev_service_name_.c_str());
+        if(stats_)
+        {
+          stats_->increment(RosNodeStats::UNREACHABLE);
+          stats_->setServerReachable(false);
+        }
+        return CheckStatus( onFailure(SERVICE_UNREACHABLE) );
+      }
+      return NodeStatus::RUNNING;
+    }
 
-    typename Request::SharedPtr request = std::make_shared<Request>();
+    // the client doesn't keep a reference to the request after sending it,
+    // therefore request_ can be reused, unless the user kept a reference to it
+    if( !reuse_requests_ || !request_ || request_.use_count() > 1 )
+    {
+      request_ = std::make_shared<Request>();
+    }
+    typename Request::SharedPtr request = request_;
 
     if( !setRequest(request) )
     {
       return CheckStatus( onFailure(INVALID_REQUEST) );
     }
 
-    future_response_ = service_client_->async_send_request(request).share();
-    time_request_sent_ = node_->now();
+    // the callback is used only to wake up the tree; the response is read from the future
+    auto on_response = [this, token = callback_guard_.token()](typename ServiceClient::SharedFuture)
+    {
+      auto lock = token.lock();
+      if(lock) {
+        if(instrumentation_) {
+          RequestTimestamps::mark(timestamps_.received);
+        }
+        emitWakeUpSignal();
+      }
+    };
+    if(instrumentation_) {
+      RequestTimestamps::mark(timestamps_.sent);
+    }
+    if(stats_)
+    {
+      stats_->increment(RosNodeStats::REQUESTS_SENT);
+      stats_->setServerReachable(true);
+    }
+    auto future_and_id = client_instance_->client->async_send_request(request, on_response);
+    future_response_ = future_and_id.future;
+    request_id_ = future_and_id.request_id;
+    deadline_.start(service_timeout_);
+    request_sent_ = true;
 
     return NodeStatus::RUNNING;
   }
 
   if (status() == NodeStatus::RUNNING)
   {
-    callback_group_executor_.spin_some();
+    {
+      const auto spin_scope = RosNodeStats::spinScope(client_instance_->executor ? stats_.get() : nullptr);
+      client_instance_->spinSome();
+    }
 
     // FIRST case: check if the goal request has a timeout
     if( !response_received_ )
     {
       auto const nodelay = std::chrono::milliseconds(0);
-      auto const timeout = rclcpp::Duration::from_seconds( double(service_timeout_.count()) / 1000);
 
-      auto ret = callback_group_executor_.spin_until_future_complete(future_response_, nodelay);
+      auto ret = client_instance_->spinUntilFutureComplete(future_response_, nodelay);
 
       if (ret != rclcpp::FutureReturnCode::SUCCESS)
       {
-        if( (node_->now() - time_request_sent_) > timeout )
+        if( deadline_.hasExpired() )
         {
+          if(stats_)
+          {
+            stats_->increment(RosNodeStats::TIMEOUTS);
+          }
+          removePendingRequest();
           return CheckStatus( onFailure(SERVICE_TIMEOUT) );
         }
         else{
@@ -305,20 +471,37 @@ template<class T> inline
     }
 
     // SECOND case: response received
+    if(instrumentation_)
+    {
+      RequestTimestamps::mark(timestamps_.consumed);
+      instrumentation_->recordRequest(prev_service_name_, timestamps_);
+    }
     return CheckStatus( onResponseReceived( response_ ) );
   }
   return NodeStatus::RUNNING;
 }
 
-template<class T> inline
+template<class T>
   void RosServiceNode<T>::halt()
 {
   if( status() == NodeStatus::RUNNING )
   {
+    deadline_.cancel();
+    removePendingRequest();
     resetStatus();
   }
 }
 
+template<class T>
+  void RosServiceNode<T>::removePendingRequest()
+{
+  if(future_response_.valid() && client_instance_)
+  {
+    client_instance_->client->remove_pending_request(request_id_);
+  }
+  future_response_ = {};
+}
+
 
 }  // namespace BT
 
@@ -15,12 +15,15 @@
 #pragma once
 
 #include <memory>
+#include <new>
 #include <string>
 #include <rclcpp/executors.hpp>
 #include <rclcpp/allocator/allocator_common.hpp>
 #include "behaviortree_cpp/condition_node.h"
 #include "behaviortree_cpp/bt_factory.h"
 #include "behaviortree_ros2/ros_node_params.hpp"
+#include "behaviortree_ros2/ros_entity_manager.hpp"
+#include "behaviortree_ros2/ros_instrumentation.hpp"
 
 namespace BT
 {
@@ -48,7 +51,7 @@ public:
                            const BT::NodeConfig& conf,
                            const RosNodeParams& params);
 
-  virtual ~RosTopicPubNode() = default;
+  virtual ~RosTopicPubNode();
 
   /**
    * @brief Any subclass of RosTopicPubNode that has additinal ports must provide a
@@ -81,6 +84,12 @@ public:
    * @brief setMessage is a callback invoked in tick to allow the user to pass
    * the message to be published.
    *
+   * If there are intra-process subscribers, msg is a new message that is moved to them.
+   * Otherwise, if the middleware supports it (shared-memory transports), msg is a loaned
+   * message, default-constructed in place, that is published without being copied.
+   * Otherwise, msg is a member of this class, reused at each tick to avoid
+   * allocations: it contains the values set in the previous invocation.
+   *
    * @param msg the message.
    * @return  return false if anything is wrong and we must not send the message.
    * the Condition will return FAILURE.
@@ -96,6 +105,19 @@ protected:
 private:
 
   std::shared_ptr<Publisher> publisher_;
+  const rclcpp::QoS qos_;
+  const rclcpp::IntraProcessSetting intra_process_;
+  // used when loaned messages are not supported
+  TopicT msg_;
+  // used only if RosNodeParams::lazy_entities is true
+  RosLazyEntity lazy_entity_;
+  // registered in RosNodeParams::instrumentation, if set
+  std::shared_ptr<RosNodeStats> stats_;
+  // see RosResourceCounters
+  RosResourceToken publisher_token_;
+
+  // count the message and return SUCCESS
+  NodeStatus published();
 
   bool createPublisher(const std::string& topic_name);
 };
@@ -104,53 +126,55 @@ private:
 //---------------------- DEFINITIONS -----------------------------
 //----------------------------------------------------------------
 
-template<class T> inline
+template<class T>
   RosTopicPubNode<T>::RosTopicPubNode(const std::string & instance_name,
                                       const NodeConfig &conf,
                                       const RosNodeParams& params)
   : BT::ConditionNode(instance_name, conf),
-  node_(params.nh)
-{ 
-  // check port remapping
-  auto portIt = config().input_ports.find("topic_name");
-  if(portIt != config().input_ports.end())
+  node_(params.nh),
+  qos_(params.topic_qos),
+  intra_process_(params.intra_process)
+{
+  if(params.instrumentation)
   {
-    const std::string& bb_topic_name = portIt->second;
+    stats_ = params.instrumentation->registerNode(*this, "topic_pub");
+  }
+  // a static name is known here; a blackboard entry is read in tick()
+  const std::string static_name = GetStaticPortName(*this, "topic_name", params);
+  topic_name_may_change_ = static_name.empty();
 
-    if(bb_topic_name.empty() || bb_topic_name == "__default__placeholder__")
-    {
-      if(params.default_port_value.empty()) {
-        throw std::logic_error(
-          "Both [topic_name] in the InputPort and the RosNodeParams are empty.");
-      }
-      else {
-        createPublisher(params.default_port_value);
-      }
-    }
-    else if(!isBlackboardPointer(bb_topic_name))
+  if(!params.lazy_entities)
+  {
+    if(!static_name.empty())
     {
-      // If the content of the port "topic_name" is not
-      // a pointer to the blackboard, but a static string, we can
-      // create the client in the constructor.
-      createPublisher(bb_topic_name);
-    }
-    else {
-      topic_name_may_change_ = true;
-      // createPublisher will be invoked in the first tick().
+      createPublisher(static_name);
     }
   }
   else {
-    if(params.default_port_value.empty()) {
-      throw std::logic_error(
-        "Both [topic_name] in the InputPort and the RosNodeParams are empty.");
-    }
-    else {
-      createPublisher(params.default_port_value);
-    }
+    lazy_entity_.enable(params.entity_manager, this,
+      [this, static_name]() {
+        if(!static_name.empty())
+        {
+          createPublisher(static_name);
+        }
+      },
+      [this]() {
+        publisher_.reset();
+        publisher_token_.reset();
+        prev_topic_name_.clear();
+        return true;
+      });
   }
 }
 
-template<class T> inline
+template<class T>
+  RosTopicPubNode<T>::~RosTopicPubNode()
+{
+  // the publisher must not be created by another thread anymore
+  lazy_entity_.disable();
+}
+
+template<class T>
   bool RosTopicPubNode<T>::createPublisher(const std::string& topic_name)
 {
   if(topic_name.empty())
@@ -158,14 +182,36 @@ template<class T> inline
     throw RuntimeError("topic_name is empty");
   }
   
-  publisher_ = node_->create_publisher<T>(topic_name, 1);
+  rclcpp::PublisherOptions pub_option;
+  pub_option.use_intra_process_comm = intra_process_;
+  publisher_ = node_->create_publisher<T>(topic_name, qos_, pub_option);
+  publisher_token_ = RosResourceToken(RosResourceCounters::PUBLISHERS);
   prev_topic_name_ = topic_name;
+  if(stats_)
+  {
+    stats_->setServerName(topic_name);
+  }
   return true;
 }
 
-template<class T> inline
+template<class T>
+  NodeStatus RosTopicPubNode<T>::published()
+{
+  if(stats_)
+  {
+    stats_->increment(RosNodeStats::MESSAGES_PUBLISHED);
+  }
+  return NodeStatus::SUCCESS;
+}
+
+template<class T>
   NodeStatus RosTopicPubNode<T>::tick()
 {
+  const auto tick_scope = RosNodeStats::tickScope(stats_.get());
+  if(lazy_entity_.enabled())
+  {
+    lazy_entity_.use();
+  }
   // First, check if the subscriber_ is valid and that the name of the
   // topic_name in the port didn't change.
   // otherwise, create a new subscriber
@@ -179,13 +225,38 @@ template<class T> inline
     }
   }
 
-  T msg;
-  if (!setMessage(msg))
+  // with subscribers in the same process, publishing a unique_ptr avoids any copy
+  if(publisher_->get_intra_process_subscription_count() > 0)
+  {
+    auto msg = std::make_unique<T>();
+    if (!setMessage(*msg))
+    {
+      return NodeStatus::FAILURE;
+    }
+    publisher_->publish(std::move(msg));
+    return published();
+  }
+
+  if(publisher_->can_loan_messages())
+  {
+    auto loaned_msg = publisher_->borrow_loaned_message();
+    // the memory provided by the middleware is not initialized
+    T* msg = new (&loaned_msg.get()) T();
+    if (!setMessage(*msg))
+    {
+      // the loan is returned to the middleware by the destructor of loaned_msg
+      return NodeStatus::FAILURE;
+    }
+    publisher_->publish(std::move(loaned_msg));
+    return published();
+  }
+
+  if (!setMessage(msg_))
   {
     return NodeStatus::FAILURE;
   }
-  publisher_->publish(msg);
-  return NodeStatus::SUCCESS;
+  publisher_->publish(msg_);
+  return published();
 }
 
 }  // namespace BT
@@ -14,18 +14,32 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <string>
+#include <type_traits>
+#include <vector>
 #include <rclcpp/executors.hpp>
 #include <rclcpp/allocator/allocator_common.hpp>
 #include "behaviortree_cpp/condition_node.h"
 #include "behaviortree_cpp/bt_factory.h"
 
 #include "behaviortree_ros2/ros_node_params.hpp"
+#include "behaviortree_ros2/ros_entity_manager.hpp"
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/message_mailbox.hpp"
+#include "behaviortree_ros2/ros_instrumentation.hpp"
 
 namespace BT
 {
 
+// true if the message has a field header.stamp, like std_msgs::msg::Header
+template<typename T, typename = void>
+struct HasHeaderStamp : std::false_type {};
+
+template<typename T>
+struct HasHeaderStamp<T, std::void_t<decltype(std::declval<T>().header.stamp)>> : std::true_type {};
+
 /**
  * @brief Abstract class to wrap a Topic subscriber.
  * Considering the example in the tutorial:
@@ -39,6 +53,10 @@ namespace BT
  *
  * 1. If a value is passes in the InputPort "topic_name", use that
  * 2. Otherwise, use the value in RosNodeParams::default_port_value
+ *
+ * Stale messages can be discarded with RosNodeParams::message_max_age and
+ * the last valid message can be kept for a while, when the topic is slower
+ * than the tree, with RosNodeParams::keep_last_message_for.
  */
 template<class TopicT>
 class RosTopicSubNode : public BT::ConditionNode
@@ -47,6 +65,7 @@ class RosTopicSubNode : public BT::ConditionNode
 public:
   // Type definitions
   using Subscriber = typename rclcpp::Subscription<TopicT>;
+  using MessageBatch = std::vector<typename TopicT::SharedPtr>;
 
   /** You are not supposed to instantiate this class directly, the factory will do it.
    * To register this class into the factory, use:
@@ -59,7 +78,7 @@ public:
                            const BT::NodeConfig& conf,
                            const RosNodeParams& params);
 
-  virtual ~RosTopicSubNode() = default;
+  virtual ~RosTopicSubNode();
 
   /**
    * @brief Any subclass of RosTopicNode that accepts parameters must provide a
@@ -88,30 +107,101 @@ public:
   NodeStatus tick() override final;
 
   /** topicCallback is the callback invoked when a message is received.
+   * When RosNodeParams::background_executor is used, it is invoked by one of
+   * the threads of the executor.
+   *
+   * The default implementation stores the message in a lock-free mailbox,
+   * read by tick(); see RosNodeParams::message_policy and
+   * RosNodeParams::message_history_depth.
    */
   virtual void topicCallback(const std::shared_ptr<TopicT> msg);
 
   /** Callback invoked in the tick. You must return either SUCCESS of FAILURE
    *
    * @param last_msg the latest message received since the last tick.
-   * it might be empty.
+   * it might be empty. With MailboxPolicy::KEEP_LATEST, it is the latest message ever
+   * received and with MailboxPolicy::KEEP_PREVIOUS the oldest one since the last tick.
+   * It is empty if older than RosNodeParams::message_max_age.
    * @return the new status of the Node, based on last_msg
    */
   virtual BT::NodeStatus onTick(const typename TopicT::SharedPtr& last_msg) = 0;
 
+  /** Callback invoked in the tick instead of onTick(), when
+   * RosNodeParams::message_history_depth is larger than 0.
+   * You must return either SUCCESS of FAILURE.
+   *
+   * @param msgs the messages received since the last tick, oldest first.
+   * It contains at most message_history_depth messages and it might be empty.
+   * Messages older than message_max_age are not included; if none is left, it
+   * contains the message kept because of keep_last_message_for, if any.
+   *
+   * The default implementation calls onTick() with the latest message.
+   */
+  virtual BT::NodeStatus onTickBatch(const MessageBatch& msgs)
+  {
+    return onTick(msgs.empty() ? typename TopicT::SharedPtr() : msgs.back());
+  }
+
 protected:
 
   std::shared_ptr<rclcpp::Node> node_;
   std::string prev_topic_name_;
   bool topic_name_may_change_ = false;
+  const std::shared_ptr<RosBackgroundExecutor> background_executor_;
+  const std::shared_ptr<RosInstrumentation> instrumentation_;
 
 private:
 
+  // the time of reception is stored next to the pointer, to avoid copying the message
+  struct ReceivedMessage
+  {
+    typename TopicT::SharedPtr msg;
+    // nanoseconds of the steady clock
+    int64_t receive_time = 0;
+  };
+
   std::shared_ptr<Subscriber> subscriber_;
-  typename TopicT::SharedPtr last_msg_;
-  bool is_message_received_;
+  MessageMailbox<ReceivedMessage> last_msg_;
+  // used instead of last_msg_ when message_history_depth > 0
+  std::unique_ptr<MessageRingBuffer<ReceivedMessage>> msg_history_;
+  std::vector<ReceivedMessage> received_batch_;
+  MessageBatch msg_batch_;
+  const rclcpp::QoS qos_;
+  const rclcpp::IntraProcessSetting intra_process_;
+  const std::chrono::nanoseconds max_age_;
+  const bool age_from_header_;
+  const std::chrono::nanoseconds keep_last_for_;
+  // last valid message, used only if keep_last_for_ > 0
+  ReceivedMessage kept_msg_;
+  // last message discarded by filterMessage() because too old: with
+  // MailboxPolicy::KEEP_LATEST it is taken again at every tick, but counted once
+  typename TopicT::SharedPtr too_old_msg_;
   rclcpp::CallbackGroup::SharedPtr callback_group_;
-  rclcpp::executors::SingleThreadedExecutor callback_group_executor_;
+  // null when background_executor_ is used
+  std::unique_ptr<rclcpp::executors::SingleThreadedExecutor> callback_group_executor_;
+  CallbackGuard callback_guard_;
+  std::shared_ptr<LatencyHistogram> age_histogram_;
+  // registered in instrumentation_, if set
+  std::shared_ptr<RosNodeStats> stats_;
+  // see RosResourceCounters
+  RosResourceToken subscription_token_;
+  RosResourceToken callback_group_token_;
+  RosResourceToken executor_token_;
+  // used only if RosNodeParams::lazy_entities is true
+  RosLazyEntity lazy_entity_;
+
+  void removeCallbackGroup();
+
+  static int64_t steadyNow()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  bool isTooOld(const ReceivedMessage& received, int64_t now) const;
+
+  // apply max_age_ and keep_last_for_ to the message taken from the mailbox
+  void filterMessage(ReceivedMessage& received, int64_t now);
 
   bool createSubscriber(const std::string& topic_name);
 };
@@ -120,79 +210,235 @@ private:
 //---------------------- DEFINITIONS -----------------------------
 //----------------------------------------------------------------
 
-template<class T> inline
+template<class T>
   RosTopicSubNode<T>::RosTopicSubNode(const std::string & instance_name,
                                       const NodeConfig &conf,
                                       const RosNodeParams& params)
     : BT::ConditionNode(instance_name, conf),
-      node_(params.nh)
-{ 
-  // check port remapping
-  auto portIt = config().input_ports.find("topic_name");
-  if(portIt != config().input_ports.end())
+      node_(params.nh),
+      background_executor_(params.background_executor),
+      instrumentation_(params.instrumentation),
+      last_msg_(params.message_policy),
+      qos_(params.topic_qos),
+      intra_process_(params.intra_process),
+      max_age_(params.message_max_age),
+      age_from_header_(params.message_age_from_header),
+      keep_last_for_(params.keep_last_message_for)
+{
+  if(params.message_history_depth > 0)
+  {
+    msg_history_ = std::make_unique<MessageRingBuffer<ReceivedMessage>>(params.message_history_depth);
+    received_batch_.reserve(params.message_history_depth);
+    msg_batch_.reserve(params.message_history_depth + 1);
+  }
+  if(instrumentation_)
   {
-    const std::string& bb_topic_name = portIt->second;
+    stats_ = instrumentation_->registerNode(*this, "topic_sub");
+  }
 
-    if(bb_topic_name.empty() || bb_topic_name == "__default__placeholder__")
-    {
-      if(params.default_port_value.empty()) {
-        throw std::logic_error(
-          "Both [topic_name] in the InputPort and the RosNodeParams are empty.");
-      }
-      else {
-        createSubscriber(params.default_port_value);
-      }
-    }
-    else if(!isBlackboardPointer(bb_topic_name))
+  // a static name is known here; a blackboard entry is read in tick()
+  const std::string static_name = GetStaticPortName(*this, "topic_name", params);
+  topic_name_may_change_ = static_name.empty();
+
+  if(!params.lazy_entities)
+  {
+    if(!static_name.empty())
     {
-      // If the content of the port "topic_name" is not
-      // a pointer to the blackboard, but a static string, we can
-      // create the client in the constructor.
-      createSubscriber(bb_topic_name);
-    }
-    else {
-      topic_name_may_change_ = true;
-      // createSubscriber will be invoked in the first tick().
+      createSubscriber(static_name);
     }
   }
   else {
-    if(params.default_port_value.empty()) {
-      throw std::logic_error(
-        "Both [topic_name] in the InputPort and the RosNodeParams are empty.");
-    }
-    else {
-      createSubscriber(params.default_port_value);
-    }
+    lazy_entity_.enable(params.entity_manager, this,
+      [this, static_name]() {
+        if(!static_name.empty())
+        {
+          createSubscriber(static_name);
+        }
+      },
+      [this]() {
+        removeCallbackGroup();
+        subscriber_.reset();
+        callback_group_executor_.reset();
+        subscription_token_.reset();
+        executor_token_.reset();
+        prev_topic_name_.clear();
+        last_msg_.clear();
+        kept_msg_ = {};
+        too_old_msg_.reset();
+        return true;
+      });
   }
 }
 
-template<class T> inline
+template<class T>
+  RosTopicSubNode<T>::~RosTopicSubNode()
+{
+  // the subscriber must not be created by another thread anymore
+  lazy_entity_.disable();
+  // make sure that no callback executed by the background executor will access this object.
+  callback_guard_.release();
+  removeCallbackGroup();
+}
+
+template<class T>
+  void RosTopicSubNode<T>::removeCallbackGroup()
+{
+  if(background_executor_ && callback_group_)
+  {
+    background_executor_->removeCallbackGroup(callback_group_);
+  }
+  callback_group_.reset();
+  callback_group_token_.reset();
+}
+
+template<class T>
   bool RosTopicSubNode<T>::createSubscriber(const std::string& topic_name)
 {
   if(topic_name.empty())
   {
     throw RuntimeError("topic_name is empty");
   }
-  
+
+  // the previous subscriber, if any, must not be spun anymore
+  removeCallbackGroup();
+
   callback_group_ = node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive, false);
-  callback_group_executor_.add_callback_group(callback_group_, node_->get_node_base_interface());
+  callback_group_token_ = RosResourceToken(RosResourceCounters::CALLBACK_GROUPS);
   rclcpp::SubscriptionOptions sub_option;
   sub_option.callback_group = callback_group_;
-  auto callback = std::bind(&RosTopicSubNode::topicCallback, this, std::placeholders::_1);
-  subscriber_ = node_->create_subscription<T>(topic_name, 1, callback, sub_option);
+  sub_option.use_intra_process_comm = intra_process_;
+  if(UsesIntraProcess(*node_, intra_process_))
+  {
+    // taking a unique_ptr, the intra-process manager can move the message
+    // published in this process, instead of copying it.
+    auto callback = [this, token = callback_guard_.token()](std::unique_ptr<T> msg)
+    {
+      auto lock = token.lock();
+      if(lock) {
+        topicCallback(std::shared_ptr<T>(std::move(msg)));
+      }
+    };
+    subscriber_ = node_->create_subscription<T>(topic_name, qos_, callback, sub_option);
+  }
+  else {
+    // with a unique_ptr, rclcpp would copy every message received from other processes
+    auto callback = [this, token = callback_guard_.token()](std::shared_ptr<T> msg)
+    {
+      auto lock = token.lock();
+      if(lock) {
+        topicCallback(std::move(msg));
+      }
+    };
+    subscriber_ = node_->create_subscription<T>(topic_name, qos_, callback, sub_option);
+  }
+  subscription_token_ = RosResourceToken(RosResourceCounters::SUBSCRIPTIONS);
   prev_topic_name_ = topic_name;
+  kept_msg_ = {};
+  if(stats_)
+  {
+    stats_->setServerName(topic_name);
+  }
+  if(instrumentation_)
+  {
+    age_histogram_ = instrumentation_->histogram(topic_name, "message_age");
+  }
+
+  if(background_executor_)
+  {
+    background_executor_->addCallbackGroup(callback_group_, node_->get_node_base_interface());
+  }
+  else {
+    callback_group_executor_ = std::make_unique<rclcpp::executors::SingleThreadedExecutor>();
+    callback_group_executor_->add_callback_group(callback_group_, node_->get_node_base_interface());
+    executor_token_ = RosResourceToken(RosResourceCounters::EXECUTORS);
+  }
   return true;
 }
 
-template<class T> inline
+template<class T>
   void RosTopicSubNode<T>::topicCallback(const std::shared_ptr<T> msg)
 {
-  last_msg_ = msg;
+  // a message is dropped if it is overwritten, replaced or discarded before being taken
+  bool dropped = false;
+  if(msg_history_)
+  {
+    dropped = !msg_history_->push({msg, steadyNow()});
+  }
+  else {
+    bool was_pending = false;
+    dropped = !last_msg_.push({msg, steadyNow()}, &was_pending) || was_pending;
+  }
+  if(stats_)
+  {
+    stats_->increment(RosNodeStats::MESSAGES_RECEIVED);
+    if(dropped)
+    {
+      stats_->increment(RosNodeStats::MESSAGES_DROPPED);
+    }
+  }
+}
+
+template<class T>
+  bool RosTopicSubNode<T>::isTooOld(const ReceivedMessage& received, int64_t now) const
+{
+  if(max_age_.count() <= 0)
+  {
+    return false;
+  }
+  if constexpr(HasHeaderStamp<T>::value)
+  {
+    if(age_from_header_)
+    {
+      const rclcpp::Time stamp(received.msg->header.stamp);
+      if(stamp.nanoseconds() != 0)
+      {
+        return (node_->now() - stamp).nanoseconds() > max_age_.count();
+      }
+    }
+  }
+  return now - received.receive_time > max_age_.count();
+}
+
+template<class T>
+  void RosTopicSubNode<T>::filterMessage(ReceivedMessage& received, int64_t now)
+{
+  if(received.msg && isTooOld(received, now))
+  {
+    if(stats_ && received.msg != too_old_msg_)
+    {
+      stats_->increment(RosNodeStats::MESSAGES_DROPPED);
+    }
+    too_old_msg_ = std::move(received.msg);
+    received = {};
+  }
+  if(keep_last_for_.count() <= 0)
+  {
+    return;
+  }
+  if(received.msg)
+  {
+    kept_msg_ = received;
+  }
+  else if(kept_msg_.msg)
+  {
+    if(now - kept_msg_.receive_time <= keep_last_for_.count() && !isTooOld(kept_msg_, now))
+    {
+      received = kept_msg_;
+    }
+    else {
+      kept_msg_ = {};
+    }
+  }
 }
 
-template<class T> inline
+template<class T>
   NodeStatus RosTopicSubNode<T>::tick()
 {
+  const auto tick_scope = RosNodeStats::tickScope(stats_.get());
+  if(lazy_entity_.enabled())
+  {
+    lazy_entity_.use();
+  }
   // First, check if the subscriber_ is valid and that the name of the
   // topic_name in the port didn't change.
   // otherwise, create a new subscriber
@@ -214,11 +460,52 @@ template<class T> inline
     }
     return status;
   };
-  callback_group_executor_.spin_some();
-  auto status = CheckStatus (onMessageReceived(last_msg_));
-  last_msg_ = nullptr;
-
-  return status;
+  if(callback_group_executor_)
+  {
+    const auto spin_scope = RosNodeStats::spinScope(stats_.get());
+    callback_group_executor_->spin_some();
+  }
+  const int64_t now = steadyNow();
+  // age of the latest message passed to the callback
+  auto RecordAge = [this, now](const ReceivedMessage& received)
+  {
+    if(age_histogram_ && received.msg)
+    {
+      instrumentation_->recordMessageAge(prev_topic_name_, *age_histogram_,
+                                         now - received.receive_time);
+    }
+  };
+  if(msg_history_)
+  {
+    msg_history_->takeAll(received_batch_);
+    ReceivedMessage latest;
+    for(auto& received: received_batch_)
+    {
+      if(!isTooOld(received, now))
+      {
+        msg_batch_.push_back(received.msg);
+        latest = std::move(received);
+      }
+      else if(stats_)
+      {
+        stats_->increment(RosNodeStats::MESSAGES_DROPPED);
+      }
+    }
+    received_batch_.clear();
+    filterMessage(latest, now);
+    if(msg_batch_.empty() && latest.msg)
+    {
+      msg_batch_.push_back(latest.msg);
+    }
+    RecordAge(latest);
+    auto status = CheckStatus (onTickBatch(msg_batch_));
+    msg_batch_.clear();
+    return status;
+  }
+  auto received = last_msg_.take();
+  filterMessage(received, now);
+  RecordAge(received);
+  return CheckStatus (onTick(received.msg));
 }
 
 }  // namespace BT
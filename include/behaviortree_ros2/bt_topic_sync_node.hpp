@@ -0,0 +1,420 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <rclcpp/executors.hpp>
+#include "behaviortree_cpp/condition_node.h"
+#include "behaviortree_cpp/bt_factory.h"
+
+#include "behaviortree_ros2/ros_node_params.hpp"
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/message_mailbox.hpp"
+#include "behaviortree_ros2/bt_topic_sub_node.hpp"
+
+namespace BT
+{
+
+/**
+ * @brief Abstract class to wrap the subscribers of multiple topics, checked together.
+ *
+ * For instance:
+ *
+ * class LocalizedNode: public RosTopicSyncNode<nav_msgs::msg::Odometry,
+ *                                              geometry_msgs::msg::PoseWithCovarianceStamped,
+ *                                              sensor_msgs::msg::BatteryState>
+ *
+ * All the subscribers belong to the same callback group, spun once per tick,
+ * and onTick() receives one message per topic. Which messages depends on
+ * RosNodeParams::sync_policy:
+ *
+ * - SyncPolicy::LATEST: the latest message received on each topic;
+ * - SyncPolicy::APPROXIMATE_TIME: the newest set of messages, not passed yet, whose
+ *   stamps are within RosNodeParams::sync_max_interval. The stamp is header.stamp,
+ *   if the message has one and it is not zero, otherwise the ROS time of reception.
+ *   Up to RosNodeParams::sync_queue_size messages per topic are kept to find it.
+ *
+ * The names of the topics are read from the InputPort "topic_names", or from
+ * RosNodeParams::default_port_value, separated by ';', in the same order of TopicT.
+ */
+template<class... TopicT>
+class RosTopicSyncNode : public BT::ConditionNode
+{
+  static_assert(sizeof...(TopicT) > 0, "RosTopicSyncNode needs at least one topic");
+
+public:
+  static constexpr size_t kNumTopics = sizeof...(TopicT);
+  // one message per topic; each one might be empty
+  using Messages = std::tuple<typename TopicT::ConstSharedPtr...>;
+
+  explicit RosTopicSyncNode(const std::string & instance_name,
+                            const BT::NodeConfig& conf,
+                            const RosNodeParams& params);
+
+  virtual ~RosTopicSyncNode();
+
+  /**
+   * @brief Any subclass of RosTopicSyncNode that accepts parameters must provide a
+   * providedPorts method and call providedBasicPorts in it.
+   * @param addition Additional ports to add to BT port list
+   * @return PortsList Containing basic ports along with node-specific ports
+   */
+  static PortsList providedBasicPorts(PortsList addition)
+  {
+    PortsList basic = {
+      InputPort<std::string>("topic_names", "__default__placeholder__",
+                             "Names of the topics, separated by ';'")
+    };
+    basic.insert(addition.begin(), addition.end());
+    return basic;
+  }
+
+  static PortsList providedPorts()
+  {
+    return providedBasicPorts({});
+  }
+
+  NodeStatus tick() override final;
+
+  /** Callback invoked in the tick. You must return either SUCCESS of FAILURE
+   *
+   * @param msgs with SyncPolicy::LATEST, the latest message of each topic, empty
+   * until the first one is received. With SyncPolicy::APPROXIMATE_TIME, either a
+   * synchronized set, or all empty if no new set was found since the previous tick.
+   */
+  virtual BT::NodeStatus onTick(const Messages& msgs) = 0;
+
+protected:
+
+  std::shared_ptr<rclcpp::Node> node_;
+  // as read from the port
+  std::string prev_topic_names_;
+  bool topic_names_may_change_ = false;
+  const std::shared_ptr<RosBackgroundExecutor> background_executor_;
+
+private:
+
+  template<class T>
+  struct StampedMessage
+  {
+    typename T::ConstSharedPtr msg;
+    // nanoseconds of the ROS clock
+    int64_t stamp = 0;
+  };
+
+  template<class T>
+  struct Channel
+  {
+    using MessageType = T;
+    std::shared_ptr<rclcpp::Subscription<T>> subscriber;
+    // SyncPolicy::LATEST
+    MessageMailbox<typename T::ConstSharedPtr> latest{MailboxPolicy::KEEP_LATEST};
+    // SyncPolicy::APPROXIMATE_TIME: received by the callback / not matched yet, oldest first
+    std::unique_ptr<MessageRingBuffer<StampedMessage<T>>> queue;
+    std::vector<StampedMessage<T>> received;
+    std::vector<StampedMessage<T>> pending;
+  };
+
+  std::tuple<Channel<TopicT>...> channels_;
+  const SyncPolicy sync_policy_;
+  const int64_t max_interval_;
+  const size_t queue_size_;
+  const rclcpp::QoS qos_;
+  const rclcpp::IntraProcessSetting intra_process_;
+  rclcpp::CallbackGroup::SharedPtr callback_group_;
+  // null when background_executor_ is used
+  std::unique_ptr<rclcpp::executors::SingleThreadedExecutor> callback_group_executor_;
+  CallbackGuard callback_guard_;
+
+  template<class Func, size_t... I>
+  void forEachChannel(Func&& func, std::index_sequence<I...>)
+  {
+    (func(std::get<I>(channels_), std::integral_constant<size_t, I>{}), ...);
+  }
+
+  /// func(channel, index), where index is a std::integral_constant
+  template<class Func>
+  void forEachChannel(Func&& func)
+  {
+    forEachChannel(std::forward<Func>(func), std::index_sequence_for<TopicT...>{});
+  }
+
+  template<class T>
+  int64_t stampOf(const T& msg) const;
+
+  void removeCallbackGroup();
+
+  void createSubscribers(const std::string& topic_names);
+
+  Messages takeLatest();
+
+  Messages takeSynchronized();
+};
+
+//----------------------------------------------------------------
+//---------------------- DEFINITIONS -----------------------------
+//----------------------------------------------------------------
+
+template<class... T>
+  RosTopicSyncNode<T...>::RosTopicSyncNode(const std::string & instance_name,
+                                           const NodeConfig &conf,
+                                           const RosNodeParams& params)
+    : BT::ConditionNode(instance_name, conf),
+      node_(params.nh),
+      background_executor_(params.background_executor),
+      sync_policy_(params.sync_policy),
+      max_interval_(std::chrono::nanoseconds(params.sync_max_interval).count()),
+      queue_size_(params.sync_queue_size > 0 ? params.sync_queue_size : 1),
+      qos_(params.topic_qos),
+      intra_process_(params.intra_process)
+{
+  if(sync_policy_ == SyncPolicy::APPROXIMATE_TIME)
+  {
+    // the messages moved from queue to pending are at most 2 * queue_size_
+    forEachChannel([this](auto& channel, auto) {
+      using Stamped = typename std::decay_t<decltype(channel.pending)>::value_type;
+      channel.queue = std::make_unique<MessageRingBuffer<Stamped>>(queue_size_);
+      channel.received.reserve(queue_size_);
+      channel.pending.reserve(2 * queue_size_);
+    });
+  }
+
+  // a static list is known here; a blackboard entry is read in tick()
+  const std::string static_names = GetStaticPortName(*this, "topic_names", params);
+  topic_names_may_change_ = static_names.empty();
+  if(!static_names.empty())
+  {
+    createSubscribers(static_names);
+  }
+}
+
+template<class... T>
+  RosTopicSyncNode<T...>::~RosTopicSyncNode()
+{
+  // make sure that no callback executed by the background executor will access this object.
+  callback_guard_.release();
+  removeCallbackGroup();
+}
+
+template<class... T>
+  void RosTopicSyncNode<T...>::removeCallbackGroup()
+{
+  if(background_executor_ && callback_group_)
+  {
+    background_executor_->removeCallbackGroup(callback_group_);
+  }
+  callback_group_.reset();
+}
+
+template<class... T> template<class MsgT>
+  int64_t RosTopicSyncNode<T...>::stampOf(const MsgT& msg) const
+{
+  if constexpr(HasHeaderStamp<MsgT>::value)
+  {
+    const int64_t stamp = rclcpp::Time(msg.header.stamp).nanoseconds();
+    if(stamp != 0)
+    {
+      return stamp;
+    }
+  }
+  return node_->now().nanoseconds();
+}
+
+template<class... T>
+  void RosTopicSyncNode<T...>::createSubscribers(const std::string& topic_names)
+{
+  std::vector<std::string> names;
+  for(const auto& part: splitString(topic_names, ';'))
+  {
+    auto name = std::string(part);
+    name.erase(0, name.find_first_not_of(' '));
+    name.erase(name.find_last_not_of(' ') + 1);
+    names.push_back(std::move(name));
+  }
+  if(names.size() != kNumTopics)
+  {
+    throw RuntimeError("RosTopicSyncNode: expected ", std::to_string(kNumTopics),
+                       " topic names, found [", topic_names, "]");
+  }
+  for(const auto& name: names)
+  {
+    if(name.empty())
+    {
+      throw RuntimeError("RosTopicSyncNode: empty topic name in [", topic_names, "]");
+    }
+  }
+
+  // the previous subscribers, if any, must not be spun anymore
+  removeCallbackGroup();
+  callback_group_executor_.reset();
+
+  callback_group_ = node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive, false);
+  rclcpp::SubscriptionOptions sub_option;
+  sub_option.callback_group = callback_group_;
+  sub_option.use_intra_process_comm = intra_process_;
+
+  forEachChannel([&](auto& channel, auto index) {
+    using MsgT = typename std::decay_t<decltype(channel)>::MessageType;
+    channel.subscriber.reset();
+    channel.latest.clear();
+    channel.pending.clear();
+    if(channel.queue)
+    {
+      channel.queue->takeAll(channel.received);
+      channel.received.clear();
+    }
+    // all the callbacks belong to the same MutuallyExclusive group: each
+    // mailbox and queue has a single producer.
+    // Taking a shared_ptr to const, the message is not copied after being received.
+    auto callback = [this, &channel, token = callback_guard_.token()](std::shared_ptr<const MsgT> msg)
+    {
+      auto lock = token.lock();
+      if(!lock) {
+        return;
+      }
+      if(channel.queue)
+      {
+        const int64_t stamp = stampOf(*msg);
+        channel.queue->push({std::move(msg), stamp});
+      }
+      else {
+        channel.latest.push(std::move(msg));
+      }
+    };
+    channel.subscriber = node_->template create_subscription<MsgT>(
+      names[decltype(index)::value], qos_, callback, sub_option);
+  });
+  prev_topic_names_ = topic_names;
+
+  if(background_executor_)
+  {
+    background_executor_->addCallbackGroup(callback_group_, node_->get_node_base_interface());
+  }
+  else {
+    callback_group_executor_ = std::make_unique<rclcpp::executors::SingleThreadedExecutor>();
+    callback_group_executor_->add_callback_group(callback_group_, node_->get_node_base_interface());
+  }
+}
+
+template<class... T>
+  typename RosTopicSyncNode<T...>::Messages RosTopicSyncNode<T...>::takeLatest()
+{
+  Messages msgs;
+  forEachChannel([&](auto& channel, auto index) {
+    std::get<decltype(index)::value>(msgs) = channel.latest.take();
+  });
+  return msgs;
+}
+
+template<class... T>
+  typename RosTopicSyncNode<T...>::Messages RosTopicSyncNode<T...>::takeSynchronized()
+{
+  bool all_available = true;
+  forEachChannel([&](auto& channel, auto) {
+    channel.queue->takeAll(channel.received);
+    for(auto& received: channel.received)
+    {
+      channel.pending.push_back(std::move(received));
+    }
+    channel.received.clear();
+    if(channel.pending.size() > queue_size_)
+    {
+      channel.pending.erase(channel.pending.begin(),
+                            channel.pending.begin() + (channel.pending.size() - queue_size_));
+    }
+    all_available = all_available && !channel.pending.empty();
+  });
+
+  Messages msgs;
+  if(!all_available)
+  {
+    return msgs;
+  }
+
+  // Each message of the first topic, newest first, is matched with the nearest
+  // message of every other topic; the first set within max_interval_ is used.
+  const auto& pivot = std::get<0>(channels_).pending;
+  std::array<size_t, kNumTopics> chosen;
+  for(size_t p = pivot.size(); p-- > 0; )
+  {
+    const int64_t stamp = pivot[p].stamp;
+    int64_t min_stamp = stamp;
+    int64_t max_stamp = stamp;
+    forEachChannel([&](auto& channel, auto index) {
+      size_t best = 0;
+      for(size_t i = 1; i < channel.pending.size(); i++)
+      {
+        if(std::llabs(channel.pending[i].stamp - stamp) < std::llabs(channel.pending[best].stamp - stamp))
+        {
+          best = i;
+        }
+      }
+      chosen[decltype(index)::value] = (decltype(index)::value == 0) ? p : best;
+      const int64_t chosen_stamp = channel.pending[chosen[decltype(index)::value]].stamp;
+      min_stamp = std::min(min_stamp, chosen_stamp);
+      max_stamp = std::max(max_stamp, chosen_stamp);
+    });
+    if(max_stamp - min_stamp > max_interval_)
+    {
+      continue;
+    }
+    // the messages of the set, and the older ones, will not be used anymore
+    forEachChannel([&](auto& channel, auto index) {
+      const size_t i = chosen[decltype(index)::value];
+      std::get<decltype(index)::value>(msgs) = std::move(channel.pending[i].msg);
+      channel.pending.erase(channel.pending.begin(), channel.pending.begin() + i + 1);
+    });
+    return msgs;
+  }
+  return msgs;
+}
+
+template<class... T>
+  NodeStatus RosTopicSyncNode<T...>::tick()
+{
+  // First, check if the subscribers are valid and that the names in the
+  // port didn't change. otherwise, create new subscribers
+  if(!callback_group_ || (status() == NodeStatus::IDLE && topic_names_may_change_))
+  {
+    std::string topic_names;
+    getInput("topic_names", topic_names);
+    if(prev_topic_names_ != topic_names)
+    {
+      createSubscribers(topic_names);
+    }
+  }
+
+  // a single spin for all the topics
+  if(callback_group_executor_)
+  {
+    callback_group_executor_->spin_some();
+  }
+  const auto status = onTick(sync_policy_ == SyncPolicy::LATEST ? takeLatest() : takeSynchronized());
+  if( !isStatusCompleted(status) )
+  {
+    throw std::logic_error("RosTopicSyncNode: the callback must return either SUCCESS or FAILURE");
+  }
+  return status;
+}
+
+}  // namespace BT
@@ -0,0 +1,228 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace BT
+{
+
+enum class MailboxPolicy
+{
+  // take() returns the latest value pushed since the previous take(),
+  // or an empty value if nothing was pushed.
+  LATEST_SINCE_LAST_TAKE,
+  // take() returns the latest value ever pushed; it is never cleared.
+  KEEP_LATEST,
+  // if a value was not taken yet, the new ones are discarded:
+  // take() returns the oldest value pushed since the previous take().
+  KEEP_PREVIOUS
+};
+
+/**
+ * @brief Lock-free, single-slot mailbox used to pass the latest value
+ * from a producer thread (a ROS callback) to a consumer thread (tick()).
+ *
+ * It is implemented as a triple buffer: push() and take() never block, never
+ * allocate and don't contend on a mutex.
+ *
+ * There must be only one producer and one consumer at a time:
+ *
+ * - push() must never be invoked concurrently. A MutuallyExclusive callback group
+ *   is not enough when a subscription is replaced while the background executor is
+ *   running the callback of the old one: the wrappers call push() while holding the
+ *   lock of their CallbackGuard::Token, that serializes the old and the new callbacks.
+ * - take(), clear() and hasNewValue() are called by the consumer only. The producer
+ *   must use the result of push() to know if the previous value was taken.
+ *
+ * Concurrent calls of push() are detected in debug builds (std::logic_error).
+ *
+ * T must be default-constructible and movable; an "empty" value is T{}.
+ */
+template<typename T>
+class MessageMailbox
+{
+public:
+  explicit MessageMailbox(MailboxPolicy policy = MailboxPolicy::LATEST_SINCE_LAST_TAKE):
+    policy_(policy)
+  {}
+
+  MessageMailbox(const MessageMailbox&) = delete;
+  MessageMailbox& operator=(const MessageMailbox&) = delete;
+
+  MailboxPolicy policy() const { return policy_; }
+
+  /**
+   * @brief Called by the producer.
+   * @param was_pending if not null, it is set to true if the value pushed before
+   *        was not taken yet (it is then replaced, or kept with KEEP_PREVIOUS).
+   * @return false if the value was discarded (KEEP_PREVIOUS only).
+   */
+  bool push(T value, bool* was_pending = nullptr)
+  {
+#ifndef NDEBUG
+    if(pushing_.exchange(true, std::memory_order_acquire))
+    {
+      throw std::logic_error("MessageMailbox::push() invoked concurrently by two producers");
+    }
+    struct ClearFlag {
+      std::atomic_bool& flag;
+      ~ClearFlag() { flag.store(false, std::memory_order_release); }
+    } clear_flag{pushing_};
+#endif
+    if(policy_ == MailboxPolicy::KEEP_PREVIOUS && (shared_.load(std::memory_order_acquire) & kDirty))
+    {
+      // only the consumer can clear the flag: the pending value is still there
+      if(was_pending) {
+        *was_pending = true;
+      }
+      return false;
+    }
+    slots_[back_] = std::move(value);
+    // publish the back slot and take ownership of the previous shared one
+    const uint8_t prev = shared_.exchange(back_ | kDirty, std::memory_order_acq_rel);
+    back_ = prev & kIndexMask;
+    if(was_pending) {
+      *was_pending = (prev & kDirty) != 0;
+    }
+    return true;
+  }
+
+  /// Called by the consumer. The result depends on the MailboxPolicy.
+  T take()
+  {
+    const bool updated = swapIfDirty();
+    if(policy_ == MailboxPolicy::KEEP_LATEST)
+    {
+      return slots_[front_];
+    }
+    if(!updated)
+    {
+      return T{};
+    }
+    return std::exchange(slots_[front_], T{});
+  }
+
+  /// Called by the consumer: true if a new value was pushed since the last take().
+  /// The producer must use the result of push() instead, see the class description.
+  bool hasNewValue() const
+  {
+    return (shared_.load(std::memory_order_acquire) & kDirty) != 0;
+  }
+
+  /// Called by the consumer: remove all the values.
+  void clear()
+  {
+    swapIfDirty();
+    slots_[front_] = T{};
+  }
+
+private:
+  // the index of the shared slot and the dirty flag are stored in the same atomic.
+  static constexpr uint8_t kIndexMask = 0x3;
+  static constexpr uint8_t kDirty = 0x4;
+
+  bool swapIfDirty()
+  {
+    if((shared_.load(std::memory_order_acquire) & kDirty) == 0)
+    {
+      return false;
+    }
+    const uint8_t prev = shared_.exchange(front_, std::memory_order_acq_rel);
+    front_ = prev & kIndexMask;
+    return true;
+  }
+
+  const MailboxPolicy policy_;
+  std::array<T, 3> slots_;
+  // owned by the producer
+  uint8_t back_ = 0;
+  // shared slot = index + dirty flag
+  std::atomic<uint8_t> shared_{1};
+  // owned by the consumer
+  uint8_t front_ = 2;
+#ifndef NDEBUG
+  std::atomic_bool pushing_{false};
+#endif
+};
+
+/**
+ * @brief Fixed-size history of the last N values, used when the consumer
+ * needs all the values received between two ticks and not only the latest one.
+ *
+ * When it is full, the oldest value is overwritten. The storage is allocated once,
+ * in the constructor; push() and takeAll() hold a mutex only for the time
+ * needed to move the values.
+ */
+template<typename T>
+class MessageRingBuffer
+{
+public:
+  explicit MessageRingBuffer(size_t capacity):
+    buffer_(capacity > 0 ? capacity : 1)
+  {}
+
+  MessageRingBuffer(const MessageRingBuffer&) = delete;
+  MessageRingBuffer& operator=(const MessageRingBuffer&) = delete;
+
+  size_t capacity() const { return buffer_.size(); }
+
+  /**
+   * @brief Called by the producer.
+   * @return false if the oldest value was overwritten.
+   */
+  bool push(T value)
+  {
+    std::unique_lock lk(mutex_);
+    buffer_[(head_ + size_) % buffer_.size()] = std::move(value);
+    if(size_ < buffer_.size())
+    {
+      size_++;
+      return true;
+    }
+    head_ = (head_ + 1) % buffer_.size();
+    return false;
+  }
+
+  /**
+   * @brief Called by the consumer: move all the values, oldest first, into output.
+   * Reserve capacity() elements in output to avoid allocations.
+   */
+  void takeAll(std::vector<T>& output)
+  {
+    output.clear();
+    std::unique_lock lk(mutex_);
+    for(size_t i = 0; i < size_; i++)
+    {
+      output.push_back(std::exchange(buffer_[(head_ + i) % buffer_.size()], T{}));
+    }
+    head_ = 0;
+    size_ = 0;
+  }
+
+private:
+  std::mutex mutex_;
+  std::vector<T> buffer_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace BT
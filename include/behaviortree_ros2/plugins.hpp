@@ -15,6 +15,7 @@
 #pragma once
 
 #include <filesystem>
+#include <vector>
 
 #include "behaviortree_cpp/bt_factory.h"
 #include "behaviortree_cpp/utils/shared_library.h"
@@ -48,6 +49,10 @@ BT_RegisterRosNodeFromPlugin(BT::BehaviorTreeFactory& factory,  \
  * @brief RegisterRosNode function used to load a plugin and register
  * the containing Node definition.
  *
+ * When the tree is executed inside a component container, params.nh should be the
+ * rclcpp::Node of the component: topics exchanged with the other components then use
+ * intra-process communication (see RosNodeParams::intra_process).
+ *
  * @param factory   the factory where the node should be registered.
  * @param filepath  path to the plugin.
  * @param params    parameters to pass to the instances of the Node.
@@ -64,6 +69,36 @@ void RegisterRosNode(BT::BehaviorTreeFactory& factory,
   func(factory, params);
 }
 
+/**
+ * @brief Load multiple plugins and register the Nodes they contain.
+ *
+ * The libraries are opened in parallel, then their Nodes are registered in the
+ * order of filepaths. Each library is kept loaded as long as the builders
+ * registered in the factory exist.
+ *
+ * If manifest_path is not empty and the file exists (see WriteRosNodesManifest()),
+ * the plugins listed in it are not loaded: their Nodes are registered using the
+ * names and ports stored in the manifest, and a library is loaded only when the
+ * first of its Nodes is instantiated. This is enough to call
+ * BT::writeTreeNodesModelXML() without opening any library; note that the types
+ * of the ports are not stored in BT::PortInfo, that accepts any type.
+ * The plugins not found in the manifest are loaded as usual, as well as those
+ * whose size or modification time differ from the ones stored in the manifest.
+ *
+ * @param factory        the factory where the nodes should be registered.
+ * @param filepaths      paths to the plugins.
+ * @param params         parameters to pass to the instances of the Nodes.
+ * @param manifest_path  optional manifest, in JSON format.
+ */
+void RegisterRosNodes(BT::BehaviorTreeFactory& factory,
+                      const std::vector<std::filesystem::path>& filepaths,
+                      const BT::RosNodeParams& params,
+                      const std::filesystem::path& manifest_path = {});
 
-
-
+/**
+ * @brief Load the plugins and write the manifest used by RegisterRosNodes():
+ * for each library, its path, size and modification time, and the name, type and ports of its Nodes.
+ * It is meant to be invoked at build or install time.
+ */
+void WriteRosNodesManifest(const std::vector<std::filesystem::path>& filepaths,
+                           const std::filesystem::path& manifest_path);
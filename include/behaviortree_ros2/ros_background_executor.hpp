@@ -0,0 +1,130 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <rclcpp/rclcpp.hpp>
+
+namespace BT
+{
+
+/**
+ * @brief Executor, spinning in its own thread(s), shared by multiple wrappers.
+ *
+ * By default, each RosActionNode, RosServiceNode and RosTopicSubNode owns an executor
+ * that is spun in tick(). When RosNodeParams::background_executor is set instead,
+ * their callback groups are added to this executor: callbacks are invoked as soon as
+ * the messages arrive, tick() only reads the state published by them and
+ * the tree is woken up with emitWakeUpSignal().
+ *
+ * Usage:
+ *
+ *    RosNodeParams params;
+ *    params.nh = node;
+ *    params.background_executor = std::make_shared<RosBackgroundExecutor>();
+ */
+class RosBackgroundExecutor
+{
+public:
+  /**
+   * @param num_threads number of threads used by the rclcpp::executors::MultiThreadedExecutor.
+   * If 0, the number of hardware threads is used.
+   */
+  explicit RosBackgroundExecutor(size_t num_threads = 1);
+
+  ~RosBackgroundExecutor();
+
+  RosBackgroundExecutor(const RosBackgroundExecutor&) = delete;
+  RosBackgroundExecutor& operator=(const RosBackgroundExecutor&) = delete;
+
+  void addCallbackGroup(rclcpp::CallbackGroup::SharedPtr group,
+                        rclcpp::node_interfaces::NodeBaseInterface::SharedPtr node_base);
+
+  void removeCallbackGroup(rclcpp::CallbackGroup::SharedPtr group);
+
+  /// Number of threads spinning the executor
+  size_t numThreads() const;
+
+private:
+  std::shared_ptr<rclcpp::executors::MultiThreadedExecutor> executor_;
+  std::thread thread_;
+};
+
+/**
+ * @brief Protect the callbacks of a wrapper from being invoked by another thread
+ * after (or while) the wrapper itself is destroyed.
+ *
+ * The callbacks capture a Token and lock it; the owner calls release() in its
+ * destructor, which waits for the callback currently running, if any.
+ *
+ *    auto callback = [this, token = callback_guard_.token()](auto msg) {
+ *      auto lock = token.lock();
+ *      if(!lock) {
+ *        return;  // the owner was destroyed
+ *      }
+ *      ...
+ *    };
+ */
+class CallbackGuard
+{
+  struct State
+  {
+    std::mutex mutex;
+    bool valid = true;
+  };
+
+public:
+  class Token
+  {
+  public:
+    /// The returned lock doesn't own the mutex if the guard was released.
+    std::unique_lock<std::mutex> lock() const
+    {
+      std::unique_lock<std::mutex> lk(state_->mutex);
+      if(!state_->valid)
+      {
+        lk.unlock();
+      }
+      return lk;
+    }
+
+  private:
+    friend class CallbackGuard;
+    explicit Token(std::shared_ptr<State> state): state_(std::move(state)) {}
+    std::shared_ptr<State> state_;
+  };
+
+  CallbackGuard(): state_(std::make_shared<State>()) {}
+
+  ~CallbackGuard() { release(); }
+
+  CallbackGuard(const CallbackGuard&) = delete;
+  CallbackGuard& operator=(const CallbackGuard&) = delete;
+
+  Token token() const { return Token(state_); }
+
+  void release()
+  {
+    std::unique_lock<std::mutex> lk(state_->mutex);
+    state_->valid = false;
+  }
+
+private:
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace BT
@@ -0,0 +1,204 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <rclcpp/rclcpp.hpp>
+#include "behaviortree_cpp/blackboard.h"
+
+#include "behaviortree_ros2/ros_node_params.hpp"
+#include "behaviortree_ros2/ros_background_executor.hpp"
+
+namespace BT
+{
+
+/**
+ * @brief Subscribe to a topic and write the latest message (or one of its fields)
+ * directly into an entry of the blackboard, from the subscription callback.
+ *
+ * It replaces the RosTopicSubNode whose only job is to copy the message into
+ * the blackboard in onTick(): the entry is updated as soon as the message arrives,
+ * even if no Node is ticked, and the message is not copied after being received.
+ * The value of the entry is a std::shared_ptr<const ValueT>; a field is exposed
+ * with the aliasing constructor of std::shared_ptr, that keeps the whole
+ * message alive.
+ *
+ *    // the whole message, in the entry "odom"
+ *    RosTopicBlackboardBridge<nav_msgs::msg::Odometry> odom_bridge(
+ *        params, tree.rootBlackboard(), "/odom", "odom");
+ *
+ *    // only the pose, in the entry "pose"
+ *    RosTopicBlackboardBridge<nav_msgs::msg::Odometry, geometry_msgs::msg::Pose> pose_bridge(
+ *        params, tree.rootBlackboard(), "/odom", "pose",
+ *        [](const nav_msgs::msg::Odometry& msg) -> const geometry_msgs::msg::Pose& {
+ *          return msg.pose.pose;
+ *        });
+ *
+ * Readers use getInput<std::shared_ptr<const ValueT>>() on a port remapped to the entry.
+ * The entry doesn't exist until the first message is received.
+ *
+ * If RosNodeParams::background_executor is set, the callback is executed by it.
+ * Otherwise, the subscription belongs to the default callback group of RosNodeParams::nh,
+ * and the application must spin that rclcpp::Node.
+ * RosNodeParams::topic_qos and RosNodeParams::intra_process are used.
+ */
+template<class TopicT, class ValueT = TopicT>
+class RosTopicBlackboardBridge
+{
+public:
+  // Type definitions
+  using Subscriber = typename rclcpp::Subscription<TopicT>;
+  using ValuePtr = std::shared_ptr<const ValueT>;
+  using Projection = std::function<const ValueT&(const TopicT&)>;
+
+  /**
+   * @param projection returns the field of the message written in the blackboard.
+   * It can be empty only if ValueT is TopicT.
+   */
+  RosTopicBlackboardBridge(const RosNodeParams& params,
+                           Blackboard::Ptr blackboard,
+                           const std::string& topic_name,
+                           const std::string& blackboard_key,
+                           Projection projection = {});
+
+  ~RosTopicBlackboardBridge();
+
+  RosTopicBlackboardBridge(const RosTopicBlackboardBridge&) = delete;
+  RosTopicBlackboardBridge& operator=(const RosTopicBlackboardBridge&) = delete;
+
+  const std::string& topicName() const { return topic_name_; }
+
+  const std::string& blackboardKey() const { return key_; }
+
+private:
+
+  std::shared_ptr<rclcpp::Node> node_;
+  const std::shared_ptr<RosBackgroundExecutor> background_executor_;
+  const std::weak_ptr<Blackboard> blackboard_;
+  const std::string topic_name_;
+  const std::string key_;
+  const Projection projection_;
+  rclcpp::CallbackGroup::SharedPtr callback_group_;
+  std::shared_ptr<Subscriber> subscriber_;
+  CallbackGuard callback_guard_;
+
+  void topicCallback(std::shared_ptr<const TopicT> msg);
+};
+
+//----------------------------------------------------------------
+//---------------------- DEFINITIONS -----------------------------
+//----------------------------------------------------------------
+
+template<class T, class V> inline
+  RosTopicBlackboardBridge<T, V>::RosTopicBlackboardBridge(const RosNodeParams& params,
+                                                           Blackboard::Ptr blackboard,
+                                                           const std::string& topic_name,
+                                                           const std::string& blackboard_key,
+                                                           Projection projection)
+    : node_(params.nh),
+      background_executor_(params.background_executor),
+      blackboard_(blackboard),
+      topic_name_(topic_name),
+      key_(blackboard_key),
+      projection_(std::move(projection))
+{
+  if(!blackboard)
+  {
+    throw RuntimeError("RosTopicBlackboardBridge: the blackboard is null");
+  }
+  if(topic_name_.empty() || key_.empty())
+  {
+    throw RuntimeError("RosTopicBlackboardBridge: topic_name and blackboard_key can not be empty");
+  }
+  if constexpr(!std::is_same_v<T, V>)
+  {
+    if(!projection_)
+    {
+      throw RuntimeError("RosTopicBlackboardBridge: a projection is needed for the topic ", topic_name_);
+    }
+  }
+
+  rclcpp::SubscriptionOptions sub_option;
+  sub_option.use_intra_process_comm = params.intra_process;
+  if(background_executor_)
+  {
+    callback_group_ = node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive, false);
+    sub_option.callback_group = callback_group_;
+  }
+  // taking a shared_ptr to const, the message is shared with the other subscribers:
+  // it is copied neither by the intra-process manager, nor after being taken from the middleware
+  auto callback = [this, token = callback_guard_.token()](std::shared_ptr<const T> msg)
+  {
+    auto lock = token.lock();
+    if(lock) {
+      topicCallback(std::move(msg));
+    }
+  };
+  subscriber_ = node_->create_subscription<T>(topic_name_, params.topic_qos, callback, sub_option);
+
+  if(background_executor_)
+  {
+    background_executor_->addCallbackGroup(callback_group_, node_->get_node_base_interface());
+  }
+}
+
+template<class T, class V> inline
+  RosTopicBlackboardBridge<T, V>::~RosTopicBlackboardBridge()
+{
+  // make sure that no callback executed by another thread will access this object.
+  callback_guard_.release();
+  if(background_executor_ && callback_group_)
+  {
+    background_executor_->removeCallbackGroup(callback_group_);
+  }
+}
+
+template<class T, class V> inline
+  void RosTopicBlackboardBridge<T, V>::topicCallback(std::shared_ptr<const T> msg)
+{
+  auto blackboard = blackboard_.lock();
+  if(!blackboard)
+  {
+    return;
+  }
+  ValuePtr value;
+  if constexpr(std::is_same_v<T, V>)
+  {
+    if(!projection_)
+    {
+      value = std::move(msg);
+    }
+  }
+  if(!value)
+  {
+    // aliasing constructor: the field shares the ownership of the message
+    const V& field = projection_(*msg);
+    value = ValuePtr(std::move(msg), &field);
+  }
+  try
+  {
+    blackboard->set(key_, std::move(value));
+  }
+  catch(std::exception& ex)
+  {
+    RCLCPP_ERROR(node_->get_logger(), "RosTopicBlackboardBridge [%s]: can't write the entry [%s]: %s",
+                 topic_name_.c_str(), key_.c_str(), ex.what());
+  }
+}
+
+}  // namespace BT
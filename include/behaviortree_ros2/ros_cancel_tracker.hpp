@@ -0,0 +1,116 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <rclcpp/rclcpp.hpp>
+
+namespace BT
+{
+
+/**
+ * @brief Keep track of the cancel requests sent by RosActionNode::halt(),
+ * without blocking the thread of the tree.
+ *
+ * When RosNodeParams::cancel_tracker is set, halt() sends the cancel request and
+ * returns immediately; the responses are processed later and failures
+ * (rejected requests or missing responses) are logged and counted.
+ * A response ERROR_GOAL_TERMINATED (the goal completed before the request
+ * was processed) is considered a success.
+ *
+ * A thread of the tracker spins, every spin_period, the clients with pending
+ * requests, unless they are executed by a RosBackgroundExecutor, and expires
+ * the requests without response.
+ *
+ * Use waitForPendingCancels() before shutting down, to make sure that
+ * the goals were cancelled by the action servers.
+ */
+class RosCancelTracker
+{
+public:
+  using SpinFunction = std::function<void()>;
+
+  explicit RosCancelTracker(rclcpp::Logger logger = rclcpp::get_logger("RosCancelTracker"),
+                            std::chrono::milliseconds spin_period = std::chrono::milliseconds(10));
+
+  ~RosCancelTracker();
+
+  RosCancelTracker(const RosCancelTracker&) = delete;
+  RosCancelTracker& operator=(const RosCancelTracker&) = delete;
+
+  /**
+   * @brief Register a cancel request.
+   *
+   * @param action_name  name of the action server, used for logging.
+   * @param timeout      after this time, without response, the request is considered failed.
+   * @param spin         function that executes the callbacks of the client, if they are not
+   *                     executed by a background executor. It is invoked by the thread of
+   *                     the tracker, therefore it must not block if the client is being
+   *                     spun by the tree (see RosClientInstance::trySpinSome()).
+   *                     It should not keep the client alive, since it might be destroyed
+   *                     inside onResponse().
+   * @return the id to be passed to onResponse().
+   */
+  uint64_t add(const std::string& action_name, std::chrono::milliseconds timeout, SpinFunction spin);
+
+  /// Invoked by the cancel callback of the client.
+  void onResponse(uint64_t id, bool success);
+
+  /// Number of cancel requests without response
+  size_t pendingCancels();
+
+  /// Number of cancel requests that were rejected or timed out
+  size_t failedCancels() const;
+
+  /**
+   * @brief Wait until all the pending requests are completed or expired.
+   *
+   * @return true if there are no pending requests.
+   */
+  bool waitForPendingCancels(std::chrono::milliseconds timeout);
+
+private:
+  struct Request
+  {
+    std::string action_name;
+    std::chrono::steady_clock::time_point deadline;
+    SpinFunction spin;
+  };
+
+  // must be called with mutex_ locked
+  void removeExpired(std::chrono::steady_clock::time_point now);
+
+  void run();
+
+  rclcpp::Logger logger_;
+  const std::chrono::milliseconds spin_period_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  uint64_t next_id_ = 0;
+  size_t failed_ = 0;
+  std::map<uint64_t, Request> pending_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace BT
@@ -0,0 +1,297 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+#include <rclcpp/rclcpp.hpp>
+
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/ros_instrumentation.hpp"
+
+namespace BT
+{
+
+/**
+ * @brief Client, callback group and executor used by one or more wrappers.
+ *
+ * ClientT is either rclcpp::Client<> or rclcpp_action::Client<>.
+ *
+ * The callback group is added either to its own executor, spun by the wrapper
+ * in tick(), or to a RosBackgroundExecutor.
+ */
+template<class ClientT>
+struct RosClientInstance
+{
+  std::shared_ptr<ClientT> client;
+  rclcpp::CallbackGroup::SharedPtr callback_group;
+  // null when background_executor is used
+  std::unique_ptr<rclcpp::executors::SingleThreadedExecutor> executor;
+  std::shared_ptr<RosBackgroundExecutor> background_executor;
+
+  // set by the graph listener of rclcpp when the ROS graph changes
+  rclcpp::Event::SharedPtr graph_event;
+  bool server_checked = false;
+  bool server_ready = false;
+
+  // see RosResourceCounters
+  RosResourceToken client_token;
+  RosResourceToken callback_group_token;
+  RosResourceToken executor_token;
+
+  /**
+   * @brief Non-blocking check of the availability of the server.
+   *
+   * The ROS graph is queried again only after graph_event was triggered,
+   * otherwise the cached value is returned.
+   */
+  bool isServerReady()
+  {
+    if(graph_event->check_and_clear() || !server_checked)
+    {
+      server_checked = true;
+      if constexpr(std::is_base_of_v<rclcpp::ClientBase, ClientT>) {
+        server_ready = client->service_is_ready();
+      }
+      else {
+        server_ready = client->action_server_is_ready();
+      }
+    }
+    return server_ready;
+  }
+
+  // the executor can be spun by the tree and by the thread of RosCancelTracker
+  std::mutex spin_mutex;
+
+  /// Execute the callbacks that are ready. No-op with the background executor.
+  void spinSome()
+  {
+    if(executor)
+    {
+      std::unique_lock lk(spin_mutex);
+      executor->spin_some();
+    }
+  }
+
+  /// Same as spinSome(), but it returns immediately if the executor is being spun by another thread.
+  void trySpinSome()
+  {
+    if(executor)
+    {
+      std::unique_lock lk(spin_mutex, std::try_to_lock);
+      if(lk.owns_lock())
+      {
+        executor->spin_some();
+      }
+    }
+  }
+
+  /// Same as rclcpp::Executor::spin_until_future_complete, but it works also when
+  /// the callbacks are executed by the background executor.
+  template<class FutureT, class DurationT>
+  rclcpp::FutureReturnCode spinUntilFutureComplete(const FutureT& future, DurationT timeout)
+  {
+    if(executor)
+    {
+      std::unique_lock lk(spin_mutex);
+      return executor->spin_until_future_complete(future, timeout);
+    }
+    return (future.wait_for(timeout) == std::future_status::ready) ?
+           rclcpp::FutureReturnCode::SUCCESS : rclcpp::FutureReturnCode::TIMEOUT;
+  }
+
+  ~RosClientInstance()
+  {
+    if(background_executor && callback_group)
+    {
+      background_executor->removeCallbackGroup(callback_group);
+    }
+  }
+};
+
+/**
+ * @brief Create a new RosClientInstance, with its own callback group and executor.
+ *
+ * @param node           the node used to create the callback group.
+ * @param background_executor  if not null, the callback group is added to it.
+ * @param create_client  a callable with signature
+ *                       std::shared_ptr<ClientT>(rclcpp::CallbackGroup::SharedPtr)
+ */
+template<class ClientT, class CreateFunc> inline
+  std::shared_ptr<RosClientInstance<ClientT>>
+  createClientInstance(const std::shared_ptr<rclcpp::Node>& node,
+                       const std::shared_ptr<RosBackgroundExecutor>& background_executor,
+                       CreateFunc&& create_client)
+{
+  auto instance = std::make_shared<RosClientInstance<ClientT>>();
+  instance->callback_group =
+    node->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive, false);
+  // create the client before adding the callback group to an executor that
+  // might be spinning in another thread
+  instance->client = create_client(instance->callback_group);
+  if(background_executor)
+  {
+    instance->background_executor = background_executor;
+    background_executor->addCallbackGroup(instance->callback_group,
+                                          node->get_node_base_interface());
+  }
+  else {
+    instance->executor = std::make_unique<rclcpp::executors::SingleThreadedExecutor>();
+    instance->executor->add_callback_group(instance->callback_group,
+                                           node->get_node_base_interface());
+  }
+  instance->graph_event = node->get_graph_event();
+  instance->client_token = RosResourceToken(RosResourceCounters::CLIENTS);
+  instance->callback_group_token = RosResourceToken(RosResourceCounters::CALLBACK_GROUPS);
+  if(instance->executor)
+  {
+    instance->executor_token = RosResourceToken(RosResourceCounters::EXECUTORS);
+  }
+  return instance;
+}
+
+/**
+ * @brief Small LRU cache of the instances used by a single wrapper, identified by the name
+ * of the server.
+ *
+ * When the name is read from the blackboard and the tree switches between a few servers,
+ * the clients used recently are reused, instead of being created and discovered again.
+ * When the cache is full, the least recently used instance is released.
+ * See RosNodeParams::client_cache_size.
+ */
+template<class InstanceT>
+class RosClientCache
+{
+public:
+  explicit RosClientCache(size_t capacity):
+    capacity_(capacity > 0 ? capacity : 1)
+  {
+    entries_.reserve(capacity_);
+  }
+
+  RosClientCache(const RosClientCache&) = delete;
+  RosClientCache& operator=(const RosClientCache&) = delete;
+
+  /// Return the instance and mark it as the most recently used, or null if not found.
+  std::shared_ptr<InstanceT> find(const std::string& name)
+  {
+    for(size_t i = 0; i < entries_.size(); i++)
+    {
+      if(entries_[i].first == name)
+      {
+        // the most recently used is the first one
+        std::rotate(entries_.begin(), entries_.begin() + i, entries_.begin() + i + 1);
+        return entries_.front().second;
+      }
+    }
+    return {};
+  }
+
+  void insert(const std::string& name, std::shared_ptr<InstanceT> instance)
+  {
+    if(entries_.size() == capacity_)
+    {
+      entries_.pop_back();
+    }
+    entries_.emplace(entries_.begin(), name, std::move(instance));
+  }
+
+  void clear() { entries_.clear(); }
+
+  size_t size() const { return entries_.size(); }
+
+private:
+  const size_t capacity_;
+  std::vector<std::pair<std::string, std::shared_ptr<InstanceT>>> entries_;
+};
+
+/**
+ * @brief Process-wide registry of the clients used by RosActionNode and RosServiceNode.
+ *
+ * Clients are identified by the tuple (rclcpp::Node, client type, server name, executor).
+ * The registry holds only weak references: an instance is destroyed, together with
+ * its callback group and executor, when the last wrapper using it is destroyed.
+ *
+ * It is used when RosNodeParams::share_clients is true.
+ * Note that wrappers sharing an instance also share its executor; unless the
+ * RosBackgroundExecutor is used, they are expected to be ticked by the same thread.
+ */
+class RosClientRegistry
+{
+public:
+  static RosClientRegistry& instance();
+
+  RosClientRegistry(const RosClientRegistry&) = delete;
+  RosClientRegistry& operator=(const RosClientRegistry&) = delete;
+
+  /**
+   * @brief Get the instance identified by (node, ClientT, name) or create it,
+   * if it doesn't exist yet, using createClientInstance().
+   */
+  template<class ClientT, class CreateFunc>
+  std::shared_ptr<RosClientInstance<ClientT>> get(const std::shared_ptr<rclcpp::Node>& node,
+                                                  const std::string& name,
+                                                  const std::shared_ptr<RosBackgroundExecutor>& background_executor,
+                                                  CreateFunc&& create_client)
+  {
+    std::unique_lock lk(mutex_);
+    removeExpired();
+
+    const Key key(node.get(), typeid(ClientT).name(), name, background_executor.get());
+    auto it = entries_.find(key);
+    // the node might have been destroyed and a new one allocated at the same address
+    if(it != entries_.end() && !it->second.node.expired())
+    {
+      if(auto existing = it->second.instance.lock())
+      {
+        return std::static_pointer_cast<RosClientInstance<ClientT>>(existing);
+      }
+    }
+    auto instance = createClientInstance<ClientT>(node, background_executor,
+                                                  std::forward<CreateFunc>(create_client));
+    entries_[key] = { node, instance };
+    return instance;
+  }
+
+  /// Number of instances currently alive
+  size_t size() const;
+
+private:
+  RosClientRegistry() = default;
+
+  using Key = std::tuple<const rclcpp::Node*, std::string, std::string, const RosBackgroundExecutor*>;
+
+  struct Entry
+  {
+    std::weak_ptr<rclcpp::Node> node;
+    std::weak_ptr<void> instance;
+  };
+
+  void removeExpired();
+
+  mutable std::mutex mutex_;
+  std::map<Key, Entry> entries_;
+};
+
+}  // namespace BT
@@ -0,0 +1,156 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <rclcpp/rclcpp.hpp>
+
+namespace BT
+{
+
+enum class TimeoutClock
+{
+  // std::chrono::steady_clock: not affected by use_sim_time or by jumps of the ROS time
+  STEADY,
+  // the clock of the rclcpp::Node, i.e. simulated time when use_sim_time is true
+  ROS
+};
+
+/**
+ * @brief Single thread that invokes callbacks at given times of the steady clock.
+ *
+ * It is shared by all the RosDeadline of the process; callbacks are
+ * executed outside of the internal mutex and must be short.
+ */
+class DeadlineScheduler
+{
+public:
+  using Callback = std::function<void()>;
+
+  static DeadlineScheduler& instance();
+
+  ~DeadlineScheduler();
+
+  DeadlineScheduler(const DeadlineScheduler&) = delete;
+  DeadlineScheduler& operator=(const DeadlineScheduler&) = delete;
+
+  /// @return an id that can be passed to cancel()
+  uint64_t schedule(std::chrono::steady_clock::time_point when, Callback callback);
+
+  /// No-op if the callback was invoked already.
+  void cancel(uint64_t id);
+
+private:
+  DeadlineScheduler();
+
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::multimap<std::chrono::steady_clock::time_point, std::pair<uint64_t, Callback>> queue_;
+  std::map<uint64_t, decltype(queue_)::iterator> entries_;
+  uint64_t next_id_ = 1;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+/**
+ * @brief Timeout computed once, when it is started.
+ *
+ * When it expires, the callback passed to the constructor is invoked by the
+ * DeadlineScheduler thread; the wrappers use it to wake up the tree with
+ * emitWakeUpSignal(), so that the timeout doesn't need to be polled.
+ *
+ * With TimeoutClock::ROS and simulated time, the expiration is checked by a
+ * jump callback of the clock, invoked at each update of the time, therefore
+ * it follows the simulation whatever its speed, and nothing runs while it is paused.
+ * Otherwise, it is scheduled on the steady clock.
+ */
+class RosDeadline
+{
+public:
+  RosDeadline(TimeoutClock clock, rclcpp::Clock::SharedPtr ros_clock,
+              std::function<void()> on_expired = {});
+
+  ~RosDeadline();
+
+  RosDeadline(const RosDeadline&) = delete;
+  RosDeadline& operator=(const RosDeadline&) = delete;
+
+  /// Current time of the selected clock
+  std::chrono::nanoseconds now() const;
+
+  /// Expire after timeout, measured from now(). A previous deadline is cancelled.
+  void start(std::chrono::nanoseconds timeout)
+  {
+    startAt(now() + timeout);
+  }
+
+  /// Expire at the given time of the selected clock. A previous deadline is cancelled.
+  void startAt(std::chrono::nanoseconds expiration);
+
+  void cancel();
+
+  /// True if started and not cancelled
+  bool isActive() const;
+
+  /// True if started and expired. With TimeoutClock::ROS it compares the
+  /// ROS time with the expiration; otherwise it doesn't read the clock.
+  bool hasExpired() const;
+
+  /// Time of expiration (selected clock), valid if isActive()
+  std::chrono::nanoseconds expiration() const;
+
+  /// True if expired and time is not later than the expiration: used when
+  /// a single RosDeadline is started with the earliest of multiple deadlines.
+  bool hasReached(std::chrono::nanoseconds time) const
+  {
+    return hasExpired() && time <= expiration();
+  }
+
+private:
+  struct State
+  {
+    TimeoutClock clock;
+    rclcpp::Clock::SharedPtr ros_clock;
+    std::function<void()> on_expired;
+    std::atomic_bool active{false};
+    std::atomic_bool expired{false};
+    std::atomic<int64_t> expiration_ns{0};
+    // incremented by startAt() and cancel(): stale callbacks are ignored
+    std::atomic<uint64_t> generation{0};
+    std::mutex mutex;
+    uint64_t scheduled_id = 0;
+  };
+
+  static void schedule(const std::shared_ptr<State>& state, uint64_t generation);
+
+  // expire, if the time was reached, or schedule again
+  static void check(const std::shared_ptr<State>& state, uint64_t generation);
+
+  std::shared_ptr<State> state_;
+  // TimeoutClock::ROS only. Destroyed first: it references state_
+  rclcpp::JumpHandler::SharedPtr jump_handler_;
+};
+
+}  // namespace BT
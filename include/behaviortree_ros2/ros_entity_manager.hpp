@@ -0,0 +1,173 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "behaviortree_cpp/bt_factory.h"
+
+namespace BT
+{
+
+class RosEntityManager;
+
+/**
+ * @brief The ROS entity (client, subscriber or publisher) of a wrapper, when
+ * RosNodeParams::lazy_entities is true.
+ *
+ * The entity is created by use(), in the first tick(), or earlier by
+ * RosEntityManager::startPrewarm(), in another thread. It can be released
+ * by RosEntityManager::releaseIdle() when it wasn't used for a while, and it is
+ * created again in the following tick().
+ */
+class RosLazyEntity
+{
+public:
+  RosLazyEntity() = default;
+
+  ~RosLazyEntity();
+
+  RosLazyEntity(const RosLazyEntity&) = delete;
+  RosLazyEntity& operator=(const RosLazyEntity&) = delete;
+
+  /**
+   * @brief Enable the lazy mode.
+   *
+   * @param manager  optional; if set, the entity can be pre-warmed and released.
+   * @param owner    the Node owning the entity.
+   * @param create   create the entity. It might be invoked by another thread.
+   * @param release  release the entity; it must return false if it can't be
+   *                 released now, for instance because the Node is RUNNING.
+   */
+  void enable(const std::shared_ptr<RosEntityManager>& manager,
+              const TreeNode* owner,
+              std::function<void()> create,
+              std::function<bool()> release);
+
+  bool enabled() const { return static_cast<bool>(create_); }
+
+  /// Unregister from the manager. To be invoked at the beginning of the destructor of the owner.
+  void disable();
+
+  /// Called by tick(): create the entity, if needed.
+  void use()
+  {
+    last_use_.store(steadyNow(), std::memory_order_relaxed);
+    if(!created_.load(std::memory_order_acquire))
+    {
+      warmUp();
+    }
+  }
+
+  /// Create the entity, if needed. Thread-safe.
+  void warmUp();
+
+  /// Called in the thread of the tree: release the entity if it wasn't used for idle_timeout.
+  bool releaseIfIdle(int64_t now, std::chrono::nanoseconds idle_timeout);
+
+  static int64_t steadyNow()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+private:
+  std::shared_ptr<RosEntityManager> manager_;
+  const TreeNode* owner_ = nullptr;
+  std::function<void()> create_;
+  std::function<bool()> release_;
+  std::mutex mutex_;
+  std::atomic_bool created_{false};
+  std::atomic<int64_t> last_use_{0};
+};
+
+/**
+ * @brief Pre-warm and release the entities of the wrappers created with
+ * RosNodeParams::lazy_entities = true and RosNodeParams::entity_manager set to this object.
+ *
+ * Large trees don't create thousands of clients and subscribers at startup:
+ *
+ *    auto manager = std::make_shared<RosEntityManager>(std::chrono::seconds(60));
+ *    params.lazy_entities = true;
+ *    params.entity_manager = manager;
+ *    ...
+ *    auto tree = factory.createTreeFromText(xml_text);
+ *    // create the entities of "Docking" first, then the rest of the tree
+ *    manager->startPrewarm(tree, {"Docking"});
+ *
+ * releaseIdle() must be invoked by the thread ticking the tree, between two ticks;
+ * RosTreeExecutor does it when RosTreeExecutor::Options::entity_manager is set.
+ */
+class RosEntityManager
+{
+public:
+  /**
+   * @param idle_timeout entities not used for this time are released by releaseIdle().
+   * If 0, they are never released.
+   */
+  explicit RosEntityManager(std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(0));
+
+  ~RosEntityManager();
+
+  RosEntityManager(const RosEntityManager&) = delete;
+  RosEntityManager& operator=(const RosEntityManager&) = delete;
+
+  /**
+   * @brief Create the entities of the tree in a background thread.
+   *
+   * @param subtree_priority names (or IDs) of the subtrees to warm up first, in this order.
+   * The other entities follow, in the order of the tree.
+   */
+  void startPrewarm(const Tree& tree, const std::vector<std::string>& subtree_priority = {});
+
+  /// Wait until the pre-warm thread is done.
+  void waitPrewarm();
+
+  /// Release the entities not used for idle_timeout. Invoke it in the thread of the tree.
+  size_t releaseIdle();
+
+  /// Number of registered entities
+  size_t size() const;
+
+private:
+  friend class RosLazyEntity;
+
+  void add(const TreeNode* owner, RosLazyEntity* entity);
+  void remove(const TreeNode* owner);
+
+  const std::chrono::nanoseconds idle_timeout_;
+  int64_t last_release_check_ = 0;
+
+  mutable std::mutex mutex_;
+  std::map<const TreeNode*, RosLazyEntity*> entities_;
+  // entity warmed up by the pre-warm thread, without holding mutex_:
+  // remove() waits until it is done, so that it can't be destroyed meanwhile.
+  RosLazyEntity* warming_up_ = nullptr;
+  std::condition_variable warm_up_done_;
+
+  std::atomic_bool stop_prewarm_{false};
+  std::thread prewarm_thread_;
+};
+
+}  // namespace BT
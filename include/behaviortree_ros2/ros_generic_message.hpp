@@ -0,0 +1,102 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeindex>
+#include <rclcpp/rclcpp.hpp>
+#include <rclcpp/serialization.hpp>
+#include <rclcpp/serialized_message.hpp>
+#include "behaviortree_cpp/exceptions.h"
+
+namespace BT
+{
+
+/**
+ * @brief Serialized message, used by RosGenericTopicSubNode and RosGenericTopicPubNode,
+ * with the name of its type, for instance "std_msgs/msg/String".
+ *
+ * The message is deserialized only if as() is invoked, the first time.
+ */
+class RosGenericMessage
+{
+public:
+  using SharedPtr = std::shared_ptr<const RosGenericMessage>;
+
+  RosGenericMessage(std::shared_ptr<const rclcpp::SerializedMessage> serialized, std::string type):
+    RosGenericMessage(std::move(serialized), std::make_shared<const std::string>(std::move(type)))
+  {}
+
+  /// The name of the type can be shared by all the messages of a topic, to avoid copying it.
+  RosGenericMessage(std::shared_ptr<const rclcpp::SerializedMessage> serialized,
+                    std::shared_ptr<const std::string> type):
+    serialized_(std::move(serialized)),
+    type_(std::move(type))
+  {}
+
+  /// Serialize a message.
+  template<class T>
+  static SharedPtr fromMessage(const T& msg)
+  {
+    auto serialized = std::make_shared<rclcpp::SerializedMessage>();
+    rclcpp::Serialization<T>().serialize_message(&msg, serialized.get());
+    return std::make_shared<RosGenericMessage>(std::move(serialized), rosidl_generator_traits::name<T>());
+  }
+
+  const rclcpp::SerializedMessage& serialized() const { return *serialized_; }
+
+  const std::shared_ptr<const rclcpp::SerializedMessage>& serializedPtr() const { return serialized_; }
+
+  const std::string& type() const { return *type_; }
+
+  /// Deserialized message; T must match type(). The result is cached.
+  template<class T>
+  std::shared_ptr<const T> as() const
+  {
+    std::unique_lock lk(mutex_);
+    if(deserialized_ && deserialized_type_ == std::type_index(typeid(T)))
+    {
+      return std::static_pointer_cast<const T>(deserialized_);
+    }
+    if(*type_ != rosidl_generator_traits::name<T>())
+    {
+      throw RuntimeError("RosGenericMessage: can't convert a message of type ", *type_,
+                         " to ", rosidl_generator_traits::name<T>());
+    }
+    auto msg = std::make_shared<T>();
+    rclcpp::Serialization<T>().deserialize_message(serialized_.get(), msg.get());
+    deserialized_ = msg;
+    deserialized_type_ = std::type_index(typeid(T));
+    return msg;
+  }
+
+private:
+  const std::shared_ptr<const rclcpp::SerializedMessage> serialized_;
+  const std::shared_ptr<const std::string> type_;
+
+  mutable std::mutex mutex_;
+  mutable std::shared_ptr<const void> deserialized_;
+  mutable std::type_index deserialized_type_ = std::type_index(typeid(void));
+};
+
+/**
+ * @brief Type of the topic, read from the ROS graph, or an empty string
+ * if the topic is not advertised yet. If there are multiple types, the first one is used.
+ */
+std::string FindTopicType(rclcpp::Node& node, const std::string& topic_name);
+
+}  // namespace BT
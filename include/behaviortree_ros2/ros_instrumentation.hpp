@@ -0,0 +1,437 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <rclcpp/rclcpp.hpp>
+
+#include "behaviortree_ros2/ros_background_executor.hpp"
+
+namespace BT
+{
+
+class TreeNode;
+
+/**
+ * @brief Timestamps of a goal or a service request, in nanoseconds of the
+ * steady clock; 0 means "not happened yet".
+ *
+ * They can be written by the callbacks of the clients, in another thread.
+ */
+struct RequestTimestamps
+{
+  std::atomic<int64_t> sent{0};
+  std::atomic<int64_t> accepted{0};
+  std::atomic<int64_t> first_feedback{0};
+  std::atomic<int64_t> received{0};
+  std::atomic<int64_t> consumed{0};
+
+  static int64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static void mark(std::atomic<int64_t>& stamp)
+  {
+    stamp.store(now(), std::memory_order_relaxed);
+  }
+
+  /// Mark the stamp only if it was not set yet.
+  static void markFirst(std::atomic<int64_t>& stamp)
+  {
+    int64_t expected = 0;
+    stamp.compare_exchange_strong(expected, now(), std::memory_order_relaxed);
+  }
+
+  void reset()
+  {
+    sent = 0;
+    accepted = 0;
+    first_feedback = 0;
+    received = 0;
+    consumed = 0;
+  }
+};
+
+/**
+ * @brief Lock-free histogram of durations, with logarithmic buckets.
+ *
+ * The upper bound of the bucket i is 2^i microseconds; the last one
+ * contains all the larger values.
+ */
+class LatencyHistogram
+{
+public:
+  static constexpr size_t kNumBuckets = 24;
+
+  void add(int64_t duration_ns);
+
+  struct Snapshot
+  {
+    uint64_t count = 0;
+    int64_t min_ns = 0;
+    int64_t max_ns = 0;
+    int64_t sum_ns = 0;
+    std::array<uint64_t, kNumBuckets> buckets = {};
+  };
+
+  Snapshot snapshot() const;
+
+  /// Upper bound of the bucket, in nanoseconds
+  static int64_t bucketUpperBound(size_t index)
+  {
+    return int64_t(1000) << index;
+  }
+
+private:
+  std::atomic<uint64_t> count_{0};
+  std::atomic<int64_t> min_ns_{INT64_MAX};
+  std::atomic<int64_t> max_ns_{0};
+  std::atomic<int64_t> sum_ns_{0};
+  std::array<std::atomic<uint64_t>, kNumBuckets> buckets_ = {};
+};
+
+/**
+ * @brief Number of ROS entities created by the wrappers and still alive, in this process.
+ *
+ * They are counted by RosClientInstance (service and action clients), RosTopicSubNode
+ * and RosTopicPubNode, with RosResourceToken, whether or not RosNodeParams::instrumentation is set.
+ */
+struct RosResourceCounters
+{
+  enum Resource
+  {
+    CLIENTS,
+    CALLBACK_GROUPS,
+    EXECUTORS,
+    SUBSCRIPTIONS,
+    PUBLISHERS,
+    NUM_RESOURCES
+  };
+
+  static std::array<std::atomic<int64_t>, NUM_RESOURCES>& values();
+
+  static int64_t get(Resource resource)
+  {
+    return values()[resource].load(std::memory_order_relaxed);
+  }
+};
+
+/**
+ * @brief Increment one of the RosResourceCounters while it is alive.
+ * A default-constructed token doesn't count anything.
+ */
+class RosResourceToken
+{
+public:
+  RosResourceToken() = default;
+
+  explicit RosResourceToken(RosResourceCounters::Resource resource):
+    resource_(resource)
+  {
+    RosResourceCounters::values()[resource_].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ~RosResourceToken()
+  {
+    reset();
+  }
+
+  RosResourceToken(RosResourceToken&& other) noexcept:
+    resource_(std::exchange(other.resource_, RosResourceCounters::NUM_RESOURCES))
+  {}
+
+  RosResourceToken& operator=(RosResourceToken&& other) noexcept
+  {
+    if(this != &other)
+    {
+      reset();
+      resource_ = std::exchange(other.resource_, RosResourceCounters::NUM_RESOURCES);
+    }
+    return *this;
+  }
+
+  void reset()
+  {
+    if(resource_ != RosResourceCounters::NUM_RESOURCES)
+    {
+      RosResourceCounters::values()[resource_].fetch_sub(1, std::memory_order_relaxed);
+      resource_ = RosResourceCounters::NUM_RESOURCES;
+    }
+  }
+
+private:
+  RosResourceCounters::Resource resource_ = RosResourceCounters::NUM_RESOURCES;
+};
+
+/**
+ * @brief Counters and timings of a single wrapper, created by RosInstrumentation::registerNode().
+ *
+ * The counters are written by the thread of the tree (and by the callbacks of the
+ * subscriptions) and read by RosInstrumentation::nodeSnapshot(), at any time.
+ */
+class RosNodeStats
+{
+public:
+  enum Counter
+  {
+    TICKS,
+    // goals or requests sent
+    REQUESTS_SENT,
+    // SEND_GOAL_TIMEOUT, RESULT_TIMEOUT or SERVICE_TIMEOUT
+    TIMEOUTS,
+    // cancel requests sent to the action server
+    CANCELS,
+    // the server was not reachable, at creation or in tick()
+    UNREACHABLE,
+    MESSAGES_RECEIVED,
+    // replaced or discarded by the mailbox before being taken, overwritten in
+    // the history, or older than message_max_age (counted once per message)
+    MESSAGES_DROPPED,
+    MESSAGES_PUBLISHED,
+    NUM_COUNTERS
+  };
+
+  RosNodeStats(std::string path, std::string type):
+    path_(std::move(path)), type_(std::move(type))
+  {}
+
+  const std::string& path() const { return path_; }
+
+  /// "action", "service", "topic_sub" or "topic_pub"
+  const std::string& type() const { return type_; }
+
+  void increment(Counter counter)
+  {
+    counters_[counter].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t get(Counter counter) const
+  {
+    return counters_[counter].load(std::memory_order_relaxed);
+  }
+
+  /// Name of the server or topic currently used
+  void setServerName(const std::string& name);
+  std::string serverName() const;
+
+  void setServerReachable(bool reachable)
+  {
+    server_reachable_.store(reachable, std::memory_order_relaxed);
+  }
+
+  bool serverReachable() const
+  {
+    return server_reachable_.load(std::memory_order_relaxed);
+  }
+
+  // duration of tick()
+  LatencyHistogram tick_duration;
+  // duration of the spin_some() executed by tick(), when there is no background executor
+  LatencyHistogram spin_duration;
+
+  /**
+   * @brief Add the time elapsed between its construction and destruction to a histogram.
+   * It does nothing if the histogram is null.
+   */
+  class ScopedTimer
+  {
+  public:
+    explicit ScopedTimer(LatencyHistogram* histogram):
+      histogram_(histogram),
+      start_ns_(histogram ? RequestTimestamps::now() : 0)
+    {}
+
+    ~ScopedTimer()
+    {
+      if(histogram_)
+      {
+        histogram_->add(RequestTimestamps::now() - start_ns_);
+      }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  private:
+    LatencyHistogram* histogram_;
+    int64_t start_ns_;
+  };
+
+  /// Used at the beginning of tick(): count the tick and measure its duration.
+  static ScopedTimer tickScope(RosNodeStats* stats)
+  {
+    if(stats)
+    {
+      stats->increment(TICKS);
+      return ScopedTimer(&stats->tick_duration);
+    }
+    return ScopedTimer(nullptr);
+  }
+
+  /// Used around spin_some()
+  static ScopedTimer spinScope(RosNodeStats* stats)
+  {
+    return ScopedTimer(stats ? &stats->spin_duration : nullptr);
+  }
+
+private:
+  const std::string path_;
+  const std::string type_;
+  std::array<std::atomic<uint64_t>, NUM_COUNTERS> counters_ = {};
+  std::atomic_bool server_reachable_{true};
+  mutable std::mutex name_mutex_;
+  std::string server_name_;
+};
+
+/**
+ * @brief Collect the latencies measured by RosActionNode, RosServiceNode
+ * and RosTopicSubNode, when RosNodeParams::instrumentation is set.
+ * When it is null, the cost for the wrappers is a pointer comparison.
+ *
+ * The histograms are identified by the name of the server (or topic) and
+ * the metric:
+ *
+ * - action:  "goal_accept", "first_feedback", "goal_execution", "result_tick_delay", "goal_total"
+ * - service: "response", "response_tick_delay", "request_total"
+ * - topic:   "message_age" (time between reception and onTick)
+ *
+ * "*_tick_delay" is the time between the arrival of the result in the client
+ * and its processing in tick(): a large value means that the tree is not ticking.
+ *
+ * The same data can be published periodically (see startPublishing()) and,
+ * if the package was built with -DBT_ROS2_TRACEPOINTS=ON, emitted as LTTng
+ * tracepoints of the provider "bt_ros2".
+ *
+ * Additionally, RosActionNode, RosServiceNode, RosTopicSubNode and RosTopicPubNode
+ * register themselves with registerNode(), to count their ticks, requests, timeouts,
+ * cancellations and messages, and to measure the duration of tick() and spin_some().
+ * Those statistics, and the RosResourceCounters, are available through the service
+ * behaviortree_ros2/srv/GetTreeStatistics (see startService()) and published at
+ * a low rate by startPublishingNodes().
+ */
+class RosInstrumentation
+{
+public:
+  RosInstrumentation() = default;
+
+  ~RosInstrumentation();
+
+  RosInstrumentation(const RosInstrumentation&) = delete;
+  RosInstrumentation& operator=(const RosInstrumentation&) = delete;
+
+  /// Get or create a histogram. The pointer can be cached by the caller.
+  std::shared_ptr<LatencyHistogram> histogram(const std::string& name, const std::string& metric);
+
+  /// Called by RosActionNode when the result is consumed in tick()
+  void recordGoal(const std::string& action_name, const RequestTimestamps& stamps);
+
+  /// Called by RosServiceNode when the response is consumed in tick()
+  void recordRequest(const std::string& service_name, const RequestTimestamps& stamps);
+
+  /// Called by RosTopicSubNode in tick()
+  void recordMessageAge(const std::string& topic_name, LatencyHistogram& histogram, int64_t age_ns);
+
+  struct Entry
+  {
+    std::string name;
+    std::string metric;
+    LatencyHistogram::Snapshot data;
+  };
+
+  std::vector<Entry> snapshot() const;
+
+  /**
+   * @brief Called by the constructors of the wrappers. The registry keeps only a
+   * weak pointer: the statistics of a Node are removed when it is destroyed.
+   *
+   * @param node  the Node is identified by TreeNode::fullPath(), or its name.
+   * @param type  "action", "service", "topic_sub" or "topic_pub".
+   */
+  std::shared_ptr<RosNodeStats> registerNode(const TreeNode& node, const char* type);
+
+  /// The Nodes that are still alive
+  std::vector<std::shared_ptr<RosNodeStats>> nodeSnapshot() const;
+
+  /**
+   * @brief Advertise a service behaviortree_ros2::srv::GetTreeStatistics.
+   *
+   * @param background_executor  if set, the service is executed by it.
+   * Otherwise it belongs to the default callback group of the node, that must be spun by the user.
+   */
+  void startService(const std::shared_ptr<rclcpp::Node>& node,
+                    const std::shared_ptr<RosBackgroundExecutor>& background_executor,
+                    const std::string& service_name = "~/bt_ros2/get_statistics");
+
+  /**
+   * @brief Publish the histograms on the topic, as behaviortree_ros2::msg::LatencyStatistics.
+   * A thread is created; it is stopped by the destructor.
+   */
+  void startPublishing(const std::shared_ptr<rclcpp::Node>& node,
+                       const std::string& topic_name = "~/bt_ros2/statistics",
+                       std::chrono::milliseconds period = std::chrono::seconds(1));
+
+  /**
+   * @brief Publish the statistics of the Nodes on the topic, as behaviortree_ros2::msg::TreeStatistics.
+   * A thread is created; it is stopped by the destructor.
+   *
+   * @param max_nodes if larger than 0, only the Nodes that spent most time in tick() are published.
+   */
+  void startPublishingNodes(const std::shared_ptr<rclcpp::Node>& node,
+                            const std::string& topic_name = "~/bt_ros2/node_statistics",
+                            std::chrono::milliseconds period = std::chrono::seconds(10),
+                            size_t max_nodes = 0);
+
+private:
+  void add(const std::string& name, const char* metric, int64_t start_ns, int64_t end_ns);
+
+  mutable std::mutex mutex_;
+  std::map<std::pair<std::string, std::string>, std::shared_ptr<LatencyHistogram>> histograms_;
+
+  // Nodes are appended by registerNode(); the expired ones are removed by nodeSnapshot(),
+  // and by registerNode() when the size reaches nodes_prune_size_
+  mutable std::vector<std::weak_ptr<RosNodeStats>> nodes_;
+  size_t nodes_prune_size_ = 64;
+
+  // execute publish() every period, in a new thread
+  void startThread(std::function<void()> publish, std::chrono::milliseconds period);
+
+  std::mutex publisher_mutex_;
+  std::condition_variable publisher_cv_;
+  bool stop_publishing_ = false;
+  std::vector<std::thread> publisher_threads_;
+  bool publishing_histograms_ = false;
+  bool publishing_nodes_ = false;
+
+  rclcpp::ServiceBase::SharedPtr service_;
+  rclcpp::CallbackGroup::SharedPtr service_callback_group_;
+  std::shared_ptr<RosBackgroundExecutor> service_executor_;
+  CallbackGuard callback_guard_;
+};
+
+}  // namespace BT
@@ -0,0 +1,131 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <rcutils/logging.h>
+
+namespace BT
+{
+
+/**
+ * @brief State of the throttling of the messages of a single source,
+ * usually a Node, passed to RosLogRing::log().
+ *
+ * Each severity is throttled separately: an ERROR is never suppressed by an INFO.
+ */
+struct RosLogThrottle
+{
+  struct Severity
+  {
+    std::atomic<int64_t> next_time{0};
+    std::atomic<uint32_t> suppressed{0};
+  };
+  // indexed by RCUTILS_LOG_SEVERITY_* / 10: UNSET, DEBUG, INFO, WARN, ERROR, FATAL
+  std::array<Severity, 6> severities;
+
+  Severity& get(int severity)
+  {
+    return severities[std::clamp<int>(severity / 10, 0, int(severities.size()) - 1)];
+  }
+};
+
+/**
+ * @brief Bounded queue of log messages, that can be written by the tree and by
+ * the callbacks of the executors without locking or allocating memory.
+ *
+ * The messages are formatted into preallocated slots and passed to the
+ * ROS logger by a thread of RosLogRing, every flush_period.
+ * When the queue is full the message is dropped, and only counted.
+ *
+ * Messages of the same RosLogThrottle and severity are throttled: in throttle_period,
+ * only the first one is logged; the number of the suppressed ones is
+ * reported by the next message.
+ *
+ * Used by RosActionNode when RosNodeParams::log_ring is set; see also RosNodeParams::realtime.
+ */
+class RosLogRing
+{
+public:
+  static constexpr size_t kLoggerNameSize = 64;
+  static constexpr size_t kTextSize = 256;
+
+  /**
+   * @param capacity  maximum number of pending messages, rounded up to a power of 2.
+   */
+  explicit RosLogRing(size_t capacity = 256,
+                      std::chrono::milliseconds flush_period = std::chrono::milliseconds(10),
+                      std::chrono::milliseconds throttle_period = std::chrono::milliseconds(1000));
+
+  ~RosLogRing();
+
+  RosLogRing(const RosLogRing&) = delete;
+  RosLogRing& operator=(const RosLogRing&) = delete;
+
+  /**
+   * @brief Thread-safe, lock-free and allocation free.
+   *
+   * @param severity     one of RCUTILS_LOG_SEVERITY_*
+   * @param logger_name  name of the rclcpp::Logger; truncated to kLoggerNameSize.
+   * @param format       printf format; the text is truncated to kTextSize.
+   * @return false if the message was throttled or dropped.
+   */
+  bool log(RosLogThrottle& throttle, int severity, const char* logger_name,
+           const char* format, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 5, 6)))
+#endif
+    ;
+
+  /// Pass the pending messages to the ROS logger. Invoked periodically by the thread of RosLogRing.
+  void flush();
+
+  /// Number of messages dropped because the queue was full
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  struct Slot
+  {
+    std::atomic<size_t> sequence;
+    int severity;
+    char logger_name[kLoggerNameSize];
+    char text[kTextSize];
+  };
+
+  const size_t mask_;
+  const int64_t throttle_period_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<size_t> write_pos_{0};
+  // used only by flush()
+  size_t read_pos_ = 0;
+  std::mutex flush_mutex_;
+  std::atomic<uint64_t> dropped_{0};
+
+  std::mutex thread_mutex_;
+  std::condition_variable thread_cv_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace BT
@@ -19,9 +19,38 @@
 #include <chrono>
 #include <memory>
 
+#include "behaviortree_ros2/message_mailbox.hpp"
+#include "behaviortree_ros2/ros_deadline.hpp"
+
 namespace BT
 {
 
+class RosBackgroundExecutor;
+class RosCancelTracker;
+class RosInstrumentation;
+class RosEntityManager;
+class RosLogRing;
+class RosParameterCache;
+class TreeNode;
+
+enum class FeedbackPolicy
+{
+  // RosActionNode::onFeedback() is invoked for every feedback received.
+  EVERY_MESSAGE,
+  // onFeedback() is invoked by tick(), at most once per tick, with the latest feedback.
+  LATEST_ONLY,
+  // same as LATEST_ONLY, but onFeedback() is invoked at most feedback_rate times per second.
+  THROTTLED
+};
+
+enum class SyncPolicy
+{
+  // RosTopicSyncNode::onTick() receives the latest message of each topic.
+  LATEST,
+  // onTick() receives the newest set of messages whose stamps are within sync_max_interval.
+  APPROXIMATE_TIME
+};
+
 struct RosNodeParams
 {
   std::shared_ptr<rclcpp::Node> nh;
@@ -36,6 +65,157 @@ struct RosNodeParams
 
   // parameter used only by service client and action clients
   std::chrono::milliseconds server_timeout = std::chrono::milliseconds(1000);
+
+  // parameter used only by service client and action clients.
+  // Clock used to measure the timeouts. With TimeoutClock::ROS they follow the
+  // simulated time when use_sim_time is true.
+  TimeoutClock timeout_clock = TimeoutClock::STEADY;
+
+  // parameter used only by action clients. Maximum time between sending the goal
+  // and its acceptance (SEND_GOAL_TIMEOUT). If 0, server_timeout is used.
+  std::chrono::milliseconds goal_accept_timeout = std::chrono::milliseconds(0);
+
+  // parameter used only by action clients. Maximum time between sending the goal
+  // and receiving its result; when it expires, the goal is cancelled and
+  // onFailure(RESULT_TIMEOUT) is invoked. If 0, there is no limit.
+  std::chrono::milliseconds result_timeout = std::chrono::milliseconds(0);
+
+  // parameter used only by action clients. Maximum time to wait for the response
+  // to a cancel request. If 0, server_timeout is used.
+  std::chrono::milliseconds cancel_timeout = std::chrono::milliseconds(0);
+
+  // parameter used only by service client and action clients.
+  // If true, all the Nodes with the same rclcpp::Node, type and server name
+  // share a single client, callback group and executor (see RosClientRegistry).
+  bool share_clients = false;
+
+  // parameter used only by service client and action clients, when the name of the server
+  // is read from the blackboard. Number of clients kept by each Node, so that switching
+  // between a few servers doesn't create and discover a new client every time.
+  // See RosClientCache.
+  size_t client_cache_size = 4;
+
+  // parameter used only by service client and action clients.
+  // If true, the constructor doesn't wait for the server to be available.
+  // Instead, tick() returns RUNNING until the server is discovered, or fails
+  // with SERVER_UNREACHABLE / SERVICE_UNREACHABLE after server_timeout.
+  bool async_discovery = false;
+
+  // parameter used by RosActionNode, RosServiceNode and RosTopicSubNode.
+  // If set, the callbacks are executed by this executor, in its own thread(s),
+  // instead of being spun in tick(). See RosBackgroundExecutor.
+  std::shared_ptr<RosBackgroundExecutor> background_executor;
+
+  // parameter used only by RosActionNode.
+  // If true, halt() sends the request to cancel the current goal without waiting
+  // for the response, so that a new goal can be sent straight away when the Node
+  // is ticked again. Late results of the cancelled goal are ignored.
+  bool preempt_goals = false;
+
+  // parameter used only by RosActionNode.
+  // If set, halt() doesn't wait for the response to the cancel request, as with
+  // preempt_goals, but the request is tracked; see RosCancelTracker.
+  std::shared_ptr<RosCancelTracker> cancel_tracker;
+
+  // parameter used only by service client and action clients.
+  // If true, setRequest() / setGoal() receive the object used in the previous request,
+  // instead of a new one, so that the memory of its strings and vectors is reused.
+  bool reuse_requests = false;
+
+  // parameter used only by RosActionNode.
+  // When background_executor or cancel_tracker are set, EVERY_MESSAGE behaves like
+  // LATEST_ONLY, since onFeedback() must be invoked in the thread of the tree, while
+  // the callbacks of the client might be executed by another one.
+  FeedbackPolicy feedback_policy = FeedbackPolicy::EVERY_MESSAGE;
+
+  // parameter used only by RosActionNode, with FeedbackPolicy::THROTTLED [Hz]
+  double feedback_rate = 10.0;
+
+  // parameter used only by RosTopicSubNode: which message is passed to onTick()
+  MailboxPolicy message_policy = MailboxPolicy::LATEST_SINCE_LAST_TAKE;
+
+  // parameter used only by RosTopicSubNode. If larger than 0, up to this number of
+  // messages received between two ticks are kept and passed to onTickBatch().
+  // message_policy is ignored in that case.
+  size_t message_history_depth = 0;
+
+  // parameter used only by RosTopicSubNode. If larger than 0, the messages older
+  // than this are discarded, as if they were never received.
+  // The age is measured from header.stamp, when the message has a header with a
+  // non-zero stamp and message_age_from_header is true, otherwise from the time of reception.
+  std::chrono::milliseconds message_max_age = std::chrono::milliseconds(0);
+  bool message_age_from_header = true;
+
+  // parameter used only by RosTopicSubNode. If larger than 0 and no new message was
+  // received since the previous tick, the last valid message is passed again to onTick(),
+  // until this time has elapsed since its reception (or it becomes older than message_max_age).
+  std::chrono::milliseconds keep_last_message_for = std::chrono::milliseconds(0);
+
+  // parameters used only by RosTopicSyncNode. sync_queue_size is the number of
+  // messages per topic kept to find a set with SyncPolicy::APPROXIMATE_TIME.
+  SyncPolicy sync_policy = SyncPolicy::LATEST;
+  std::chrono::milliseconds sync_max_interval = std::chrono::milliseconds(50);
+  size_t sync_queue_size = 10;
+
+  // parameter used only by RosTopicSubNode and RosTopicPubNode.
+  // For high-rate sensor streams, consider rclcpp::SensorDataQoS() (best effort).
+  rclcpp::QoS topic_qos = rclcpp::QoS(rclcpp::KeepLast(1));
+
+  // parameter used only by RosTopicSubNode and RosTopicPubNode.
+  // By default, intra-process communication is used if the rclcpp::Node was created
+  // with rclcpp::NodeOptions().use_intra_process_comms(true). Messages exchanged with
+  // other nodes in the same process (or component container) are then passed as
+  // std::unique_ptr, without serialization. Otherwise RosTopicSubNode takes the
+  // messages as std::shared_ptr, that rclcpp doesn't copy.
+  rclcpp::IntraProcessSetting intra_process = rclcpp::IntraProcessSetting::NodeDefault;
+
+  // parameter used by RosActionNode, RosServiceNode, RosTopicSubNode and RosTopicPubNode.
+  // If set, the latencies of goals, requests and messages are recorded and the Nodes
+  // are registered with their counters and timings; see RosInstrumentation.
+  std::shared_ptr<RosInstrumentation> instrumentation;
+
+  // parameter used by RosActionNode, RosServiceNode, RosTopicSubNode and RosTopicPubNode.
+  // If true, the client, subscriber or publisher is not created by the constructor,
+  // but in the first tick(), or earlier by entity_manager (see RosEntityManager),
+  // that can also release it after a period of inactivity.
+  bool lazy_entities = false;
+  std::shared_ptr<RosEntityManager> entity_manager;
+
+  // parameter used only by RosParameterNode. Cache of the parameters of the remote nodes,
+  // shared by all the Nodes; if null, RosParameterCache::shared(nh) is used.
+  std::shared_ptr<RosParameterCache> parameter_cache;
+
+  // parameter used only by RosActionNode. If set, the messages logged by tick() and by
+  // the callbacks of the client are written into this lock-free queue, and throttled,
+  // instead of being passed directly to the ROS logger; see RosLogRing.
+  std::shared_ptr<RosLogRing> log_ring;
+
+  // parameter used only by RosActionNode. If true, tick() doesn't allocate memory while
+  // the goal is RUNNING, nor to read the name of the server from the blackboard, unless
+  // it was changed. It requires background_executor and log_ring, and implies reuse_requests.
+  // The goal itself is sent by rclcpp_action, that allocates memory.
+  bool realtime = false;
 };
 
+/**
+ * @brief Used by the constructors of the wrappers to resolve the name of the server
+ * or topic, passed in the InputPort port_name:
+ *
+ * - if the port is empty or missing, RosNodeParams::default_port_value is used;
+ * - if it contains a static string, that string is returned;
+ * - if it points to a blackboard entry, an empty string is returned: the name
+ *   must be read in tick().
+ *
+ * @throw std::logic_error if both the port and default_port_value are empty.
+ */
+std::string GetStaticPortName(const TreeNode& node,
+                              const std::string& port_name,
+                              const RosNodeParams& params);
+
+/**
+ * @brief True if a subscription created by the node with this setting uses
+ * intra-process communication (RosNodeParams::intra_process).
+ */
+bool UsesIntraProcess(const rclcpp::Node& node, rclcpp::IntraProcessSetting setting);
+
 }
@@ -0,0 +1,107 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <rclcpp/rclcpp.hpp>
+#include <rcl_interfaces/msg/parameter_event.hpp>
+#include <rcl_interfaces/msg/parameter_value.hpp>
+
+#include "behaviortree_ros2/ros_background_executor.hpp"
+
+namespace BT
+{
+
+/**
+ * @brief Local copy of the parameters of remote nodes, updated by /parameter_events.
+ *
+ * Used by RosParameterNode: only the nodes whose parameters were looked up are
+ * tracked, and a parameter is known either because it was received with
+ * GetParameters, after a cache miss, or because it was changed afterwards.
+ *
+ * It can be shared by many Nodes, see RosNodeParams::parameter_cache; when that is
+ * not set, the Nodes use the one returned by shared().
+ */
+class RosParameterCache
+{
+public:
+  using ParameterValue = rcl_interfaces::msg::ParameterValue;
+
+  /**
+   * @param background_executor  if set, the events are processed by it;
+   *                             otherwise, by spinSome().
+   */
+  explicit RosParameterCache(std::shared_ptr<rclcpp::Node> node,
+                             std::shared_ptr<RosBackgroundExecutor> background_executor = {});
+
+  ~RosParameterCache();
+
+  RosParameterCache(const RosParameterCache&) = delete;
+  RosParameterCache& operator=(const RosParameterCache&) = delete;
+
+  /**
+   * @brief Cache shared by all the users of the same rclcpp::Node, created on the first call.
+   * It is destroyed when the last user releases it.
+   *
+   * @param background_executor  used only by the call that creates the cache.
+   */
+  static std::shared_ptr<RosParameterCache> shared(
+    const std::shared_ptr<rclcpp::Node>& node,
+    const std::shared_ptr<RosBackgroundExecutor>& background_executor = {});
+
+  /// Process the events received, unless the background executor is used. Thread-safe.
+  void spinSome();
+
+  /**
+   * @brief Read a parameter of a remote node.
+   *
+   * @param node_name  fully qualified name, for instance "/controller_server".
+   * @return false on a cache miss: from now on, the events of node_name are tracked.
+   * A parameter that is not set is cached with the type PARAMETER_NOT_SET.
+   */
+  bool lookup(const std::string& node_name, const std::string& parameter, ParameterValue& value);
+
+  /**
+   * @brief Store the value received with GetParameters, unless a
+   * more recent one was received by /parameter_events in the meantime.
+   */
+  void store(const std::string& node_name, const std::string& parameter, const ParameterValue& value);
+
+  /// Number of parameters in the cache
+  size_t size() const;
+
+private:
+  void onEvent(const rcl_interfaces::msg::ParameterEvent& event);
+
+  std::shared_ptr<rclcpp::Node> node_;
+  std::shared_ptr<RosBackgroundExecutor> background_executor_;
+
+  mutable std::mutex mutex_;
+  // node name -> parameter name -> value
+  std::unordered_map<std::string, std::unordered_map<std::string, ParameterValue>> nodes_;
+
+  rclcpp::CallbackGroup::SharedPtr callback_group_;
+  // null when background_executor_ is used
+  std::unique_ptr<rclcpp::executors::SingleThreadedExecutor> executor_;
+  std::mutex spin_mutex_;
+  rclcpp::Subscription<rcl_interfaces::msg::ParameterEvent>::SharedPtr subscriber_;
+  CallbackGuard callback_guard_;
+};
+
+}  // namespace BT
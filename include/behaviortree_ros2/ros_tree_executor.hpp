@@ -0,0 +1,99 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include "behaviortree_cpp/bt_factory.h"
+
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/ros_entity_manager.hpp"
+
+namespace BT
+{
+
+/**
+ * @brief Tick a tree only when something happened.
+ *
+ * While the tree is RUNNING, the thread sleeps until one of its Nodes calls
+ * emitWakeUpSignal() (for instance, when a result, a feedback or a message
+ * is received) or until max_sleep expires.
+ *
+ * The tree is woken up by ROS callbacks only if its Nodes use the
+ * RosBackgroundExecutor owned by this class:
+ *
+ *    RosTreeExecutor tree_executor;
+ *
+ *    RosNodeParams params;
+ *    params.nh = node;
+ *    params.background_executor = tree_executor.backgroundExecutor();
+ *    factory.registerNodeType<MyActionNode>("MyAction", params);
+ *
+ *    auto tree = factory.createTreeFromText(xml_text);
+ *    tree_executor.tickWhileRunning(tree);
+ *
+ * Otherwise, the callbacks are executed only when the Nodes are ticked
+ * and max_sleep becomes the period of the tree.
+ */
+class RosTreeExecutor
+{
+public:
+  struct Options
+  {
+    // maximum time between two ticks of a RUNNING tree
+    std::chrono::milliseconds max_sleep = std::chrono::milliseconds(100);
+    // threads of the RosBackgroundExecutor
+    size_t num_threads = 1;
+    // if set, RosEntityManager::releaseIdle() is invoked after each tick
+    std::shared_ptr<RosEntityManager> entity_manager;
+  };
+
+  RosTreeExecutor();
+
+  explicit RosTreeExecutor(const Options& options);
+
+  RosTreeExecutor(const RosTreeExecutor&) = delete;
+  RosTreeExecutor& operator=(const RosTreeExecutor&) = delete;
+
+  /// Executor to be passed to RosNodeParams::background_executor
+  std::shared_ptr<RosBackgroundExecutor> backgroundExecutor() const;
+
+  /**
+   * @brief Tick the tree until it returns SUCCESS or FAILURE, stop() is invoked or
+   * ROS is shut down.
+   *
+   * @return the last status of the tree. It is RUNNING if the
+   * execution was interrupted; in that case, the tree is halted.
+   */
+  NodeStatus tickWhileRunning(Tree& tree);
+
+  /**
+   * @brief Interrupt tickWhileRunning(). It can be invoked from any thread.
+   * If it is invoked before tickWhileRunning(), the tree is ticked only once.
+   */
+  void stop();
+
+private:
+  Options options_;
+  std::shared_ptr<RosBackgroundExecutor> background_executor_;
+  std::atomic_bool stop_requested_{false};
+
+  std::mutex tree_mutex_;
+  Tree* running_tree_ = nullptr;
+};
+
+}  // namespace BT
@@ -0,0 +1,221 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "behaviortree_ros2/bt_generic_topic_sub_node.hpp"
+#include "behaviortree_ros2/bt_generic_topic_pub_node.hpp"
+
+namespace BT
+{
+
+std::string FindTopicType(rclcpp::Node& node, const std::string& topic_name)
+{
+  const auto resolved_name = node.get_node_topics_interface()->resolve_topic_name(topic_name);
+  const auto topics = node.get_topic_names_and_types();
+  auto it = topics.find(resolved_name);
+  if(it == topics.end() || it->second.empty())
+  {
+    return {};
+  }
+  return it->second.front();
+}
+
+//----------------------------------------------------------------
+
+RosGenericTopicSubNode::RosGenericTopicSubNode(const std::string & instance_name,
+                                               const NodeConfig &conf,
+                                               const RosNodeParams& params)
+  : BT::ConditionNode(instance_name, conf),
+  node_(params.nh),
+  background_executor_(params.background_executor),
+  last_msg_(params.message_policy),
+  qos_(params.topic_qos)
+{
+  topic_name_ = GetStaticPortName(*this, "topic_name", params);
+  if(topic_name_.empty())
+  {
+    topic_name_may_change_ = true;
+    // createSubscriber will be invoked in the first tick().
+  }
+  else {
+    // if the type is not known yet, it is discovered in tick()
+    createSubscriber(topic_name_);
+  }
+}
+
+RosGenericTopicSubNode::~RosGenericTopicSubNode()
+{
+  // make sure that no callback executed by the background executor will access this object.
+  callback_guard_.release();
+  removeCallbackGroup();
+}
+
+void RosGenericTopicSubNode::removeCallbackGroup()
+{
+  if(background_executor_ && callback_group_)
+  {
+    background_executor_->removeCallbackGroup(callback_group_);
+  }
+  callback_group_.reset();
+}
+
+bool RosGenericTopicSubNode::createSubscriber(const std::string& topic_name)
+{
+  if(topic_name.empty())
+  {
+    throw RuntimeError("topic_name is empty");
+  }
+  std::string topic_type;
+  getInput("topic_type", topic_type);
+  if(topic_type.empty())
+  {
+    // get_topic_names_and_types() is expensive: the graph is queried again only if it changed
+    if(!graph_event_)
+    {
+      graph_event_ = node_->get_graph_event();
+    }
+    else if(!graph_event_->check_and_clear() && topic_name == undiscovered_topic_)
+    {
+      return false;
+    }
+    topic_type = FindTopicType(*node_, topic_name);
+    if(topic_type.empty())
+    {
+      undiscovered_topic_ = topic_name;
+      return false;
+    }
+    graph_event_.reset();
+    undiscovered_topic_.clear();
+  }
+
+  // the previous subscriber, if any, must not be spun anymore
+  removeCallbackGroup();
+  subscriber_.reset();
+  last_msg_.clear();
+
+  topic_type_ = std::make_shared<const std::string>(topic_type);
+  callback_group_ = node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive, false);
+  rclcpp::SubscriptionOptions sub_option;
+  sub_option.callback_group = callback_group_;
+  auto callback = [this, token = callback_guard_.token(), type = topic_type_]
+    (std::shared_ptr<rclcpp::SerializedMessage> msg)
+  {
+    auto lock = token.lock();
+    if(lock) {
+      last_msg_.push(std::make_shared<const RosGenericMessage>(std::move(msg), type));
+    }
+  };
+  subscriber_ = node_->create_generic_subscription(topic_name, topic_type, qos_, callback, sub_option);
+  prev_topic_name_ = topic_name;
+
+  if(background_executor_)
+  {
+    background_executor_->addCallbackGroup(callback_group_, node_->get_node_base_interface());
+  }
+  else {
+    callback_group_executor_ = std::make_unique<rclcpp::executors::SingleThreadedExecutor>();
+    callback_group_executor_->add_callback_group(callback_group_, node_->get_node_base_interface());
+  }
+  return true;
+}
+
+NodeStatus RosGenericTopicSubNode::tick()
+{
+  if(status() == NodeStatus::IDLE && topic_name_may_change_)
+  {
+    getInput("topic_name", topic_name_);
+  }
+  auto CheckStatus = [](NodeStatus status)
+  {
+    if( !isStatusCompleted(status) )
+    {
+      throw std::logic_error("RosGenericTopicSubNode: the callback must return either SUCCESS or FAILURE");
+    }
+    return status;
+  };
+
+  if(!subscriber_ || prev_topic_name_ != topic_name_)
+  {
+    if(!createSubscriber(topic_name_))
+    {
+      // the topic was not advertised yet
+      return CheckStatus( onTick({}) );
+    }
+  }
+
+  if(callback_group_executor_)
+  {
+    callback_group_executor_->spin_some();
+  }
+  return CheckStatus( onTick(last_msg_.take()) );
+}
+
+//----------------------------------------------------------------
+
+RosGenericTopicPubNode::RosGenericTopicPubNode(const std::string & instance_name,
+                                               const NodeConfig &conf,
+                                               const RosNodeParams& params)
+  : BT::ConditionNode(instance_name, conf),
+  node_(params.nh),
+  qos_(params.topic_qos)
+{
+  topic_name_ = GetStaticPortName(*this, "topic_name", params);
+  topic_name_may_change_ = topic_name_.empty();
+  // if the type isn't in the port, the publisher is created when the first message is available
+  getInput("topic_type", topic_type_);
+  if(!topic_name_.empty() && !topic_type_.empty())
+  {
+    publisher_ = node_->create_generic_publisher(topic_name_, topic_type_, qos_);
+    prev_topic_name_ = topic_name_;
+  }
+}
+
+NodeStatus RosGenericTopicPubNode::tick()
+{
+  if(topic_name_may_change_)
+  {
+    getInput("topic_name", topic_name_);
+  }
+
+  RosGenericMessage::SharedPtr msg;
+  if(!setMessage(msg) || !msg)
+  {
+    return NodeStatus::FAILURE;
+  }
+
+  if(!publisher_ || prev_topic_name_ != topic_name_)
+  {
+    if(topic_name_.empty())
+    {
+      throw RuntimeError("topic_name is empty");
+    }
+    getInput("topic_type", topic_type_);
+    if(topic_type_.empty())
+    {
+      topic_type_ = msg->type();
+    }
+    publisher_ = node_->create_generic_publisher(topic_name_, topic_type_, qos_);
+    prev_topic_name_ = topic_name_;
+  }
+
+  if(msg->type() != topic_type_)
+  {
+    RCLCPP_ERROR(node_->get_logger(), "%s: can't publish a message of type %s on the topic %s [%s]",
+                 name().c_str(), msg->type().c_str(), prev_topic_name_.c_str(), topic_type_.c_str());
+    return NodeStatus::FAILURE;
+  }
+  publisher_->publish(msg->serialized());
+  return NodeStatus::SUCCESS;
+}
+
+}  // namespace BT
@@ -0,0 +1,123 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "behaviortree_ros2/bt_parameter_node.hpp"
+
+#include <rclcpp/expand_topic_or_service_name.hpp>
+
+namespace BT
+{
+
+namespace
+{
+
+const std::string kServiceSuffix = "/get_parameters";
+
+}  // namespace
+
+RosParameterNode::RosParameterNode(const std::string & instance_name,
+                                   const NodeConfig &conf,
+                                   const RosNodeParams& params)
+  : ROS::RosServiceNode<rcl_interfaces::srv::GetParameters>(instance_name, conf, params),
+  cache_(params.parameter_cache ? params.parameter_cache :
+         RosParameterCache::shared(params.nh, params.background_executor))
+{}
+
+NodeStatus RosParameterNode::onStart()
+{
+  if(!getInput("parameter", parameter_) || parameter_.empty())
+  {
+    throw RuntimeError("RosParameterNode: the port [parameter] is empty");
+  }
+  if(remote_service_ != prev_service_name_)
+  {
+    const auto expanded = rclcpp::expand_topic_or_service_name(
+      prev_service_name_, node_->get_name(), node_->get_namespace(), true);
+    if(expanded.size() <= kServiceSuffix.size() ||
+       expanded.compare(expanded.size() - kServiceSuffix.size(), kServiceSuffix.size(), kServiceSuffix) != 0)
+    {
+      throw RuntimeError("RosParameterNode: the name of the service must end with ",
+                         kServiceSuffix, ": ", prev_service_name_);
+    }
+    remote_node_ = expanded.substr(0, expanded.size() - kServiceSuffix.size());
+    remote_service_ = prev_service_name_;
+  }
+
+  cache_->spinSome();
+  rcl_interfaces::msg::ParameterValue value;
+  if(cache_->lookup(remote_node_, parameter_, value))
+  {
+    return writeValue(value);
+  }
+  // cache miss: send the request
+  return NodeStatus::RUNNING;
+}
+
+bool RosParameterNode::setRequest(Request::SharedPtr& request)
+{
+  request->names.assign(1, parameter_);
+  return true;
+}
+
+NodeStatus RosParameterNode::onResponseReceived(const Response::SharedPtr& response)
+{
+  if(response->values.size() != 1)
+  {
+    return NodeStatus::FAILURE;
+  }
+  cache_->store(remote_node_, parameter_, response->values.front());
+  return writeValue(response->values.front());
+}
+
+NodeStatus RosParameterNode::writeValue(const rcl_interfaces::msg::ParameterValue& value)
+{
+  using rcl_interfaces::msg::ParameterType;
+  switch(value.type)
+  {
+    case ParameterType::PARAMETER_BOOL:
+      setOutput("value", value.bool_value);
+      break;
+    case ParameterType::PARAMETER_INTEGER:
+      setOutput("value", value.integer_value);
+      break;
+    case ParameterType::PARAMETER_DOUBLE:
+      setOutput("value", value.double_value);
+      break;
+    case ParameterType::PARAMETER_STRING:
+      setOutput("value", value.string_value);
+      break;
+    case ParameterType::PARAMETER_BYTE_ARRAY:
+      setOutput("value", value.byte_array_value);
+      break;
+    case ParameterType::PARAMETER_BOOL_ARRAY:
+      setOutput("value", value.bool_array_value);
+      break;
+    case ParameterType::PARAMETER_INTEGER_ARRAY:
+      setOutput("value", value.integer_array_value);
+      break;
+    case ParameterType::PARAMETER_DOUBLE_ARRAY:
+      setOutput("value", value.double_array_value);
+      break;
+    case ParameterType::PARAMETER_STRING_ARRAY:
+      setOutput("value", value.string_array_value);
+      break;
+    default:
+      // PARAMETER_NOT_SET
+      return NodeStatus::FAILURE;
+  }
+  return NodeStatus::SUCCESS;
+}
+
+}  // namespace BT
@@ -1,4 +1,50 @@
+#include "behaviortree_ros2/ros_client_registry.hpp"
+
 #include "behaviortree_ros2/bt_action_node.hpp"
+#include "behaviortree_ros2/bt_multi_action_node.hpp"
 #include "behaviortree_ros2/bt_service_node.hpp"
+#include "behaviortree_ros2/bt_service_batch_node.hpp"
 #include "behaviortree_ros2/bt_topic_sub_node.hpp"
 #include "behaviortree_ros2/bt_topic_pub_node.hpp"
+#include "behaviortree_ros2/bt_topic_sync_node.hpp"
+#include "behaviortree_ros2/ros_blackboard_bridge.hpp"
+#include "behaviortree_ros2/ros_entity_manager.hpp"
+
+namespace BT
+{
+
+RosClientRegistry& RosClientRegistry::instance()
+{
+  static RosClientRegistry registry;
+  return registry;
+}
+
+size_t RosClientRegistry::size() const
+{
+  std::unique_lock lk(mutex_);
+  size_t count = 0;
+  for(const auto& [key, entry]: entries_)
+  {
+    if(!entry.instance.expired() && !entry.node.expired())
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+void RosClientRegistry::removeExpired()
+{
+  for(auto it = entries_.begin(); it != entries_.end(); )
+  {
+    if(it->second.instance.expired() || it->second.node.expired())
+    {
+      it = entries_.erase(it);
+    }
+    else {
+      it++;
+    }
+  }
+}
+
+}  // namespace BT
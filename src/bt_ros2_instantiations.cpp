@@ -0,0 +1,21 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// the explicit instantiations must not be preceded by the extern declarations
+#define BT_ROS2_INSTANTIATIONS_SOURCE
+#include "behaviortree_ros2/bt_ros2_instantiations.hpp"
+
+BT_ROS2_FOR_EACH_TOPIC_TYPE(BT_ROS2_INSTANTIATE_TOPIC)
+BT_ROS2_FOR_EACH_SERVICE_TYPE(BT_ROS2_INSTANTIATE_SERVICE)
+BT_ROS2_FOR_EACH_ACTION_TYPE(BT_ROS2_INSTANTIATE_ACTION)
@@ -0,0 +1,46 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// LTTng-UST provider of BT::RosInstrumentation, used only with -DBT_ROS2_TRACEPOINTS=ON.
+//
+//    lttng create && lttng enable-event -u 'bt_ros2:*' && lttng start
+
+#undef TRACEPOINT_PROVIDER
+#define TRACEPOINT_PROVIDER bt_ros2
+
+#undef TRACEPOINT_INCLUDE
+#define TRACEPOINT_INCLUDE "bt_ros2_tracepoints.h"
+
+#if !defined(BT_ROS2_TRACEPOINTS_H) || defined(TRACEPOINT_HEADER_MULTI_READ)
+#define BT_ROS2_TRACEPOINTS_H
+
+#include <lttng/tracepoint.h>
+
+TRACEPOINT_EVENT(
+  bt_ros2,
+  latency,
+  TP_ARGS(
+    const char*, name_arg,
+    const char*, metric_arg,
+    int64_t, duration_ns_arg),
+  TP_FIELDS(
+    ctf_string(name, name_arg)
+    ctf_string(metric, metric_arg)
+    ctf_integer(int64_t, duration_ns, duration_ns_arg)
+  )
+)
+
+#endif  // BT_ROS2_TRACEPOINTS_H
+
+#include <lttng/tracepoint-event.h>
@@ -0,0 +1,305 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "behaviortree_ros2/plugins.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "behaviortree_cpp/contrib/json.hpp"
+
+namespace
+{
+
+using PluginFunc = void (*)(BT::BehaviorTreeFactory&, const BT::RosNodeParams&);
+
+std::filesystem::path normalizedPath(const std::filesystem::path& path)
+{
+  return std::filesystem::absolute(path).lexically_normal();
+}
+
+std::shared_ptr<BT::SharedLibrary> loadLibrary(const std::filesystem::path& filepath)
+{
+  auto library = std::make_shared<BT::SharedLibrary>();
+  library->load(filepath.string());
+  return library;
+}
+
+/// Register the Nodes of the plugin in a new factory, that contains only them and the builtin Nodes.
+std::unique_ptr<BT::BehaviorTreeFactory> pluginFactory(BT::SharedLibrary& library,
+                                                       const BT::RosNodeParams& params)
+{
+  auto func = (PluginFunc)library.getSymbol("BT_RegisterRosNodeFromPlugin");
+  auto factory = std::make_unique<BT::BehaviorTreeFactory>();
+  func(*factory, params);
+  return factory;
+}
+
+/// Call func(index) for every index in [0, count), using multiple threads.
+template<class Func>
+void parallelFor(size_t count, Func&& func)
+{
+  const size_t num_threads = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for(size_t t = 0; t < num_threads; t++)
+  {
+    threads.emplace_back([&]() {
+      for(size_t i = next++; i < count; i = next++)
+      {
+        func(i);
+      }
+    });
+  }
+  for(auto& thread: threads)
+  {
+    thread.join();
+  }
+}
+
+/// Size and modification time of the library, stored in the manifest to detect
+/// that it was rebuilt afterwards.
+nlohmann::json libraryStamp(const std::filesystem::path& filepath)
+{
+  nlohmann::json stamp;
+  stamp["size"] = std::filesystem::file_size(filepath);
+  stamp["mtime"] = std::filesystem::last_write_time(filepath).time_since_epoch().count();
+  return stamp;
+}
+
+/// Builder of a library that was loaded: the builder, whose code belongs to
+/// the library, is destroyed before the library is closed.
+struct LoadedBuilder
+{
+  std::shared_ptr<BT::SharedLibrary> library;
+  BT::NodeBuilder builder;
+
+  std::unique_ptr<BT::TreeNode> operator()(const std::string& name, const BT::NodeConfig& config) const
+  {
+    return builder(name, config);
+  }
+};
+
+/// Plugin listed in the manifest: it is loaded by the first builder invoked.
+struct LazyPlugin
+{
+  std::filesystem::path filepath;
+  BT::RosNodeParams params;
+
+  std::mutex mutex;
+  // declared first: the factory, and its builders, are destroyed before it
+  std::shared_ptr<BT::SharedLibrary> library;
+  std::unique_ptr<BT::BehaviorTreeFactory> factory;
+
+  const BT::NodeBuilder& builder(const std::string& registration_id)
+  {
+    std::unique_lock lk(mutex);
+    if(!factory)
+    {
+      library = loadLibrary(filepath);
+      factory = pluginFactory(*library, params);
+    }
+    const auto& builders = factory->builders();
+    auto it = builders.find(registration_id);
+    if(it == builders.end())
+    {
+      throw BT::RuntimeError("Can't find the Node [", registration_id, "] in the plugin ",
+                             filepath.string(), ". Is the manifest outdated?");
+    }
+    return it->second;
+  }
+};
+
+BT::TreeNodeManifest manifestFromJson(const nlohmann::json& json)
+{
+  BT::TreeNodeManifest manifest;
+  manifest.registration_ID = json.at("id").get<std::string>();
+  manifest.type = BT::convertFromString<BT::NodeType>(json.at("type").get<std::string>());
+  for(const auto& port_json: json.value("ports", nlohmann::json::array()))
+  {
+    BT::PortInfo port(BT::convertFromString<BT::PortDirection>(port_json.at("direction").get<std::string>()));
+    port.setDescription(port_json.value("description", ""));
+    const std::string default_value = port_json.value("default", "");
+    if(!default_value.empty())
+    {
+      port.setDefaultValue(default_value);
+    }
+    manifest.ports.insert({port_json.at("name").get<std::string>(), std::move(port)});
+  }
+  for(const auto& pair: json.value("metadata", nlohmann::json::array()))
+  {
+    manifest.metadata.emplace_back(pair.at(0).get<std::string>(), pair.at(1).get<std::string>());
+  }
+  return manifest;
+}
+
+nlohmann::json manifestToJson(const BT::TreeNodeManifest& manifest)
+{
+  nlohmann::json json;
+  json["id"] = manifest.registration_ID;
+  json["type"] = BT::toStr(manifest.type);
+  json["ports"] = nlohmann::json::array();
+  for(const auto& [name, port]: manifest.ports)
+  {
+    nlohmann::json port_json;
+    port_json["name"] = name;
+    port_json["direction"] = BT::toStr(port.direction());
+    // informative only: the type can't be restored
+    port_json["type"] = port.typeName();
+    port_json["default"] = port.defaultValueString();
+    port_json["description"] = port.description();
+    json["ports"].push_back(std::move(port_json));
+  }
+  json["metadata"] = nlohmann::json::array();
+  for(const auto& [key, value]: manifest.metadata)
+  {
+    json["metadata"].push_back({key, value});
+  }
+  return json;
+}
+
+}  // namespace
+
+void RegisterRosNodes(BT::BehaviorTreeFactory& factory,
+                      const std::vector<std::filesystem::path>& filepaths,
+                      const BT::RosNodeParams& params,
+                      const std::filesystem::path& manifest_path)
+{
+  // plugins described by the manifest: normalized path -> Nodes
+  std::map<std::filesystem::path, nlohmann::json> manifest_plugins;
+  if(!manifest_path.empty() && std::filesystem::exists(manifest_path))
+  {
+    std::ifstream file(manifest_path);
+    const auto json = nlohmann::json::parse(file);
+    // relative paths are relative to the directory of the manifest
+    const auto manifest_dir = normalizedPath(manifest_path).parent_path();
+    for(const auto& plugin: json.at("plugins"))
+    {
+      const std::filesystem::path path = plugin.at("path").get<std::string>();
+      const auto filepath = (manifest_dir / path).lexically_normal();
+      // a library rebuilt after the manifest was written is loaded
+      std::error_code error;
+      if(!std::filesystem::exists(filepath, error) ||
+         plugin.value("stamp", nlohmann::json()) != libraryStamp(filepath))
+      {
+        continue;
+      }
+      manifest_plugins[filepath] = plugin.at("nodes");
+    }
+  }
+
+  std::vector<std::filesystem::path> to_load;
+  for(const auto& filepath: filepaths)
+  {
+    if(manifest_plugins.count(normalizedPath(filepath)) == 0)
+    {
+      to_load.push_back(filepath);
+    }
+  }
+
+  // the libraries are opened in parallel, but the Nodes are registered by this thread
+  std::vector<std::shared_ptr<BT::SharedLibrary>> libraries(to_load.size());
+  std::vector<std::exception_ptr> errors(to_load.size());
+  parallelFor(to_load.size(), [&](size_t i) {
+    try {
+      libraries[i] = loadLibrary(to_load[i]);
+    }
+    catch(...) {
+      errors[i] = std::current_exception();
+    }
+  });
+  for(const auto& error: errors)
+  {
+    if(error)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+  size_t loaded_index = 0;
+  for(const auto& filepath: filepaths)
+  {
+    auto it = manifest_plugins.find(normalizedPath(filepath));
+    if(it != manifest_plugins.end())
+    {
+      auto plugin = std::make_shared<LazyPlugin>();
+      plugin->filepath = filepath;
+      plugin->params = params;
+      for(const auto& node_json: it->second)
+      {
+        auto manifest = manifestFromJson(node_json);
+        const std::string id = manifest.registration_ID;
+        factory.registerBuilder(manifest, [plugin, id](const std::string& name, const BT::NodeConfig& config) {
+          return plugin->builder(id)(name, config);
+        });
+      }
+      continue;
+    }
+
+    const auto& library = libraries[loaded_index++];
+    const auto plugin_factory = pluginFactory(*library, params);
+    const auto& builtin = plugin_factory->builtinNodes();
+    for(const auto& [id, builder]: plugin_factory->builders())
+    {
+      if(builtin.count(id) != 0)
+      {
+        continue;
+      }
+      // the builder keeps the library loaded
+      factory.registerBuilder(plugin_factory->manifests().at(id), LoadedBuilder{library, builder});
+    }
+  }
+}
+
+void WriteRosNodesManifest(const std::vector<std::filesystem::path>& filepaths,
+                           const std::filesystem::path& manifest_path)
+{
+  const auto manifest_dir = normalizedPath(manifest_path).parent_path();
+
+  nlohmann::json json;
+  json["plugins"] = nlohmann::json::array();
+  for(const auto& filepath: filepaths)
+  {
+    auto library = loadLibrary(filepath);
+    const auto plugin_factory = pluginFactory(*library, BT::RosNodeParams());
+    const auto& builtin = plugin_factory->builtinNodes();
+
+    nlohmann::json plugin;
+    // relative to the manifest, so that both can be installed elsewhere
+    plugin["path"] = normalizedPath(filepath).lexically_relative(manifest_dir).string();
+    plugin["stamp"] = libraryStamp(filepath);
+    plugin["nodes"] = nlohmann::json::array();
+    for(const auto& [id, manifest]: plugin_factory->manifests())
+    {
+      if(builtin.count(id) == 0)
+      {
+        plugin["nodes"].push_back(manifestToJson(manifest));
+      }
+    }
+    json["plugins"].push_back(std::move(plugin));
+  }
+
+  std::ofstream file(manifest_path);
+  if(!file)
+  {
+    throw BT::RuntimeError("Can't write the manifest ", manifest_path.string());
+  }
+  file << json.dump(2) << std::endl;
+}
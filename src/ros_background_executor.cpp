@@ -0,0 +1,58 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "behaviortree_ros2/ros_background_executor.hpp"
+
+namespace BT
+{
+
+RosBackgroundExecutor::RosBackgroundExecutor(size_t num_threads)
+{
+  executor_ = std::make_shared<rclcpp::executors::MultiThreadedExecutor>(
+    rclcpp::ExecutorOptions(), num_threads);
+
+  // MultiThreadedExecutor::spin() blocks until cancel() is called,
+  // even if no callback group was added yet.
+  thread_ = std::thread([executor = executor_]() {
+    executor->spin();
+  });
+}
+
+RosBackgroundExecutor::~RosBackgroundExecutor()
+{
+  executor_->cancel();
+  if(thread_.joinable())
+  {
+    thread_.join();
+  }
+}
+
+void RosBackgroundExecutor::addCallbackGroup(
+  rclcpp::CallbackGroup::SharedPtr group,
+  rclcpp::node_interfaces::NodeBaseInterface::SharedPtr node_base)
+{
+  executor_->add_callback_group(group, node_base, true);
+}
+
+void RosBackgroundExecutor::removeCallbackGroup(rclcpp::CallbackGroup::SharedPtr group)
+{
+  executor_->remove_callback_group(group, true);
+}
+
+size_t RosBackgroundExecutor::numThreads() const
+{
+  return executor_->get_number_of_threads();
+}
+
+}  // namespace BT
@@ -0,0 +1,146 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "behaviortree_ros2/ros_cancel_tracker.hpp"
+
+#include <vector>
+
+namespace BT
+{
+
+RosCancelTracker::RosCancelTracker(rclcpp::Logger logger, std::chrono::milliseconds spin_period):
+  logger_(std::move(logger)),
+  spin_period_(spin_period),
+  thread_([this]() { run(); })
+{}
+
+RosCancelTracker::~RosCancelTracker()
+{
+  {
+    std::unique_lock lk(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+uint64_t RosCancelTracker::add(const std::string& action_name,
+                               std::chrono::milliseconds timeout,
+                               SpinFunction spin)
+{
+  uint64_t id = 0;
+  {
+    std::unique_lock lk(mutex_);
+    id = next_id_++;
+    pending_[id] = { action_name, std::chrono::steady_clock::now() + timeout, std::move(spin) };
+  }
+  // wake up the thread
+  cv_.notify_all();
+  return id;
+}
+
+void RosCancelTracker::onResponse(uint64_t id, bool success)
+{
+  {
+    std::unique_lock lk(mutex_);
+    auto it = pending_.find(id);
+    if(it == pending_.end())
+    {
+      // already expired
+      return;
+    }
+    if(!success)
+    {
+      failed_++;
+      RCLCPP_ERROR(logger_, "Cancel request to action server [%s] was rejected",
+                   it->second.action_name.c_str());
+    }
+    pending_.erase(it);
+  }
+  cv_.notify_all();
+}
+
+size_t RosCancelTracker::pendingCancels()
+{
+  std::unique_lock lk(mutex_);
+  removeExpired(std::chrono::steady_clock::now());
+  return pending_.size();
+}
+
+size_t RosCancelTracker::failedCancels() const
+{
+  std::unique_lock lk(mutex_);
+  return failed_;
+}
+
+bool RosCancelTracker::waitForPendingCancels(std::chrono::milliseconds timeout)
+{
+  // the requests are spun and expired by run()
+  std::unique_lock lk(mutex_);
+  cv_.wait_for(lk, timeout, [this]{ return pending_.empty(); });
+  removeExpired(std::chrono::steady_clock::now());
+  return pending_.empty();
+}
+
+void RosCancelTracker::run()
+{
+  std::unique_lock lk(mutex_);
+  while(!stop_)
+  {
+    if(pending_.empty())
+    {
+      cv_.wait(lk, [this]{ return stop_ || !pending_.empty(); });
+      continue;
+    }
+    std::vector<SpinFunction> spin_functions;
+    for(const auto& [id, request]: pending_)
+    {
+      if(request.spin)
+      {
+        spin_functions.push_back(request.spin);
+      }
+    }
+    lk.unlock();
+    // onResponse() may be invoked here
+    for(const auto& spin: spin_functions)
+    {
+      spin();
+    }
+    // release the clients captured by the functions outside of the lock
+    spin_functions.clear();
+    lk.lock();
+    removeExpired(std::chrono::steady_clock::now());
+    cv_.notify_all();
+    cv_.wait_for(lk, spin_period_, [this]{ return stop_; });
+  }
+}
+
+void RosCancelTracker::removeExpired(std::chrono::steady_clock::time_point now)
+{
+  for(auto it = pending_.begin(); it != pending_.end(); )
+  {
+    if(now > it->second.deadline)
+    {
+      failed_++;
+      RCLCPP_ERROR(logger_, "No response to the cancel request sent to action server [%s]",
+                   it->second.action_name.c_str());
+      it = pending_.erase(it);
+    }
+    else {
+      it++;
+    }
+  }
+}
+
+}  // namespace BT
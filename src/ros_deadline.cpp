@@ -0,0 +1,279 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "behaviortree_ros2/ros_deadline.hpp"
+
+#include <algorithm>
+
+namespace BT
+{
+
+DeadlineScheduler& DeadlineScheduler::instance()
+{
+  static DeadlineScheduler scheduler;
+  return scheduler;
+}
+
+DeadlineScheduler::DeadlineScheduler():
+  thread_([this]() { run(); })
+{}
+
+DeadlineScheduler::~DeadlineScheduler()
+{
+  {
+    std::unique_lock lk(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if(thread_.joinable())
+  {
+    thread_.join();
+  }
+}
+
+uint64_t DeadlineScheduler::schedule(std::chrono::steady_clock::time_point when, Callback callback)
+{
+  std::unique_lock lk(mutex_);
+  const uint64_t id = next_id_++;
+  auto it = queue_.emplace(when, std::make_pair(id, std::move(callback)));
+  entries_[id] = it;
+  // wake up the thread only if the earliest deadline changed
+  const bool earliest = (it == queue_.begin());
+  lk.unlock();
+  if(earliest)
+  {
+    cv_.notify_one();
+  }
+  return id;
+}
+
+void DeadlineScheduler::cancel(uint64_t id)
+{
+  std::unique_lock lk(mutex_);
+  auto it = entries_.find(id);
+  if(it != entries_.end())
+  {
+    queue_.erase(it->second);
+    entries_.erase(it);
+  }
+}
+
+void DeadlineScheduler::run()
+{
+  std::unique_lock lk(mutex_);
+  while(!stop_)
+  {
+    if(queue_.empty())
+    {
+      cv_.wait(lk);
+      continue;
+    }
+    const auto when = queue_.begin()->first;
+    if(std::chrono::steady_clock::now() < when)
+    {
+      cv_.wait_until(lk, when);
+      continue;
+    }
+    auto callback = std::move(queue_.begin()->second.second);
+    entries_.erase(queue_.begin()->second.first);
+    queue_.erase(queue_.begin());
+
+    lk.unlock();
+    callback();
+    lk.lock();
+  }
+}
+
+//----------------------------------------------------------------
+
+RosDeadline::RosDeadline(TimeoutClock clock, rclcpp::Clock::SharedPtr ros_clock,
+                         std::function<void()> on_expired):
+  state_(std::make_shared<State>())
+{
+  state_->clock = clock;
+  state_->ros_clock = std::move(ros_clock);
+  state_->on_expired = std::move(on_expired);
+  if(state_->clock == TimeoutClock::ROS && !state_->ros_clock)
+  {
+    throw std::invalid_argument("RosDeadline: TimeoutClock::ROS requires a rclcpp::Clock");
+  }
+  if(state_->clock == TimeoutClock::ROS)
+  {
+    // invoked at every update of the simulated time, and when it is enabled or disabled
+    rcl_jump_threshold_t threshold;
+    threshold.on_clock_change = true;
+    threshold.min_forward.nanoseconds = 1;
+    threshold.min_backward.nanoseconds = -1;
+
+    std::weak_ptr<State> weak_state = state_;
+    auto on_jump = [weak_state](const rcl_time_jump_t& jump)
+    {
+      auto state = weak_state.lock();
+      if(!state || !state->active || state->expired)
+      {
+        return;
+      }
+      const bool reached = state->ros_clock->now().nanoseconds() >= state->expiration_ns;
+      if(!reached && jump.clock_change != RCL_ROS_TIME_DEACTIVATED)
+      {
+        return;
+      }
+      // the mutex of the clock is locked here: on_expired is invoked by the scheduler
+      const uint64_t generation = state->generation;
+      DeadlineScheduler::instance().schedule(std::chrono::steady_clock::now(),
+        [weak_state, generation]() {
+          if(auto locked_state = weak_state.lock()) {
+            check(locked_state, generation);
+          }
+        });
+    };
+    jump_handler_ = state_->ros_clock->create_jump_callback(nullptr, on_jump, threshold);
+  }
+}
+
+RosDeadline::~RosDeadline()
+{
+  cancel();
+}
+
+std::chrono::nanoseconds RosDeadline::now() const
+{
+  if(state_->clock == TimeoutClock::ROS)
+  {
+    return std::chrono::nanoseconds(state_->ros_clock->now().nanoseconds());
+  }
+  return std::chrono::steady_clock::now().time_since_epoch();
+}
+
+void RosDeadline::startAt(std::chrono::nanoseconds expiration)
+{
+  uint64_t generation = 0;
+  {
+    std::unique_lock lk(state_->mutex);
+    if(state_->scheduled_id != 0)
+    {
+      DeadlineScheduler::instance().cancel(state_->scheduled_id);
+      state_->scheduled_id = 0;
+    }
+    generation = ++state_->generation;
+    state_->expiration_ns = expiration.count();
+    state_->expired = false;
+    state_->active = true;
+  }
+  schedule(state_, generation);
+}
+
+void RosDeadline::cancel()
+{
+  std::unique_lock lk(state_->mutex);
+  state_->generation++;
+  state_->active = false;
+  state_->expired = false;
+  if(state_->scheduled_id != 0)
+  {
+    DeadlineScheduler::instance().cancel(state_->scheduled_id);
+    state_->scheduled_id = 0;
+  }
+}
+
+bool RosDeadline::isActive() const
+{
+  return state_->active;
+}
+
+bool RosDeadline::hasExpired() const
+{
+  if(!state_->active)
+  {
+    return false;
+  }
+  if(state_->clock == TimeoutClock::ROS)
+  {
+    return state_->expired || state_->ros_clock->now().nanoseconds() >= state_->expiration_ns;
+  }
+  return state_->expired;
+}
+
+std::chrono::nanoseconds RosDeadline::expiration() const
+{
+  return std::chrono::nanoseconds(state_->expiration_ns.load());
+}
+
+void RosDeadline::schedule(const std::shared_ptr<State>& state, uint64_t generation)
+{
+  auto remaining = std::chrono::nanoseconds(state->expiration_ns.load());
+  if(state->clock == TimeoutClock::ROS)
+  {
+    remaining -= std::chrono::nanoseconds(state->ros_clock->now().nanoseconds());
+    // simulated time: checked by the jump callback, at the next update of the time
+    if(remaining.count() > 0 && state->ros_clock->ros_time_is_active())
+    {
+      return;
+    }
+  }
+  else {
+    remaining -= std::chrono::steady_clock::now().time_since_epoch();
+  }
+
+  std::weak_ptr<State> weak_state = state;
+  auto callback = [weak_state, generation]()
+  {
+    if(auto state = weak_state.lock()) {
+      check(state, generation);
+    }
+  };
+
+  std::unique_lock lk(state->mutex);
+  if(state->generation != generation)
+  {
+    return;
+  }
+  state->scheduled_id = DeadlineScheduler::instance().schedule(
+    std::chrono::steady_clock::now() + std::max(remaining, std::chrono::nanoseconds(0)),
+    std::move(callback));
+}
+
+void RosDeadline::check(const std::shared_ptr<State>& state, uint64_t generation)
+{
+  if(state->generation != generation)
+  {
+    return;
+  }
+  if(state->clock == TimeoutClock::ROS &&
+     state->ros_clock->now().nanoseconds() < state->expiration_ns)
+  {
+    schedule(state, generation);
+    return;
+  }
+  {
+    std::unique_lock lk(state->mutex);
+    if(state->generation != generation || state->expired)
+    {
+      return;
+    }
+    // expired by the jump callback, while a steady wakeup was scheduled
+    if(state->scheduled_id != 0)
+    {
+      DeadlineScheduler::instance().cancel(state->scheduled_id);
+      state->scheduled_id = 0;
+    }
+    state->expired = true;
+  }
+  if(state->on_expired)
+  {
+    state->on_expired();
+  }
+}
+
+}  // namespace BT
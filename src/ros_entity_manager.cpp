@@ -0,0 +1,228 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "behaviortree_ros2/ros_entity_manager.hpp"
+
+#include <set>
+
+namespace BT
+{
+
+RosLazyEntity::~RosLazyEntity()
+{
+  disable();
+}
+
+void RosLazyEntity::enable(const std::shared_ptr<RosEntityManager>& manager,
+                           const TreeNode* owner,
+                           std::function<void()> create,
+                           std::function<bool()> release)
+{
+  create_ = std::move(create);
+  release_ = std::move(release);
+  owner_ = owner;
+  manager_ = manager;
+  if(manager_)
+  {
+    manager_->add(owner_, this);
+  }
+}
+
+void RosLazyEntity::disable()
+{
+  if(manager_)
+  {
+    manager_->remove(owner_);
+    manager_.reset();
+  }
+}
+
+void RosLazyEntity::warmUp()
+{
+  std::unique_lock lk(mutex_);
+  if(!created_.load(std::memory_order_relaxed))
+  {
+    create_();
+    // not released by releaseIdle() before being used
+    last_use_.store(steadyNow(), std::memory_order_relaxed);
+    created_.store(true, std::memory_order_release);
+  }
+}
+
+bool RosLazyEntity::releaseIfIdle(int64_t now, std::chrono::nanoseconds idle_timeout)
+{
+  if(!created_.load(std::memory_order_acquire) ||
+     now - last_use_.load(std::memory_order_relaxed) < idle_timeout.count())
+  {
+    return false;
+  }
+  std::unique_lock lk(mutex_);
+  if(!release_())
+  {
+    return false;
+  }
+  created_.store(false, std::memory_order_release);
+  return true;
+}
+
+//----------------------------------------------------------------
+
+RosEntityManager::RosEntityManager(std::chrono::milliseconds idle_timeout):
+  idle_timeout_(idle_timeout)
+{}
+
+RosEntityManager::~RosEntityManager()
+{
+  stop_prewarm_ = true;
+  waitPrewarm();
+}
+
+void RosEntityManager::add(const TreeNode* owner, RosLazyEntity* entity)
+{
+  std::unique_lock lk(mutex_);
+  entities_[owner] = entity;
+}
+
+void RosEntityManager::remove(const TreeNode* owner)
+{
+  std::unique_lock lk(mutex_);
+  auto it = entities_.find(owner);
+  if(it == entities_.end())
+  {
+    return;
+  }
+  RosLazyEntity* entity = it->second;
+  entities_.erase(it);
+  warm_up_done_.wait(lk, [&]() { return warming_up_ != entity; });
+}
+
+size_t RosEntityManager::size() const
+{
+  std::unique_lock lk(mutex_);
+  return entities_.size();
+}
+
+void RosEntityManager::startPrewarm(const Tree& tree, const std::vector<std::string>& subtree_priority)
+{
+  waitPrewarm();
+
+  // the order is computed here, since the tree must not be accessed by another thread.
+  // The Nodes are used only as keys of entities_: if a Node is destroyed in the
+  // meantime, its entity is not found.
+  std::vector<const TreeNode*> order;
+  std::set<const TreeNode*> added;
+  auto AddSubtree = [&](const Tree::Subtree& subtree)
+  {
+    for(const auto& node: subtree.nodes)
+    {
+      if(added.insert(node.get()).second)
+      {
+        order.push_back(node.get());
+      }
+    }
+  };
+  for(const auto& name: subtree_priority)
+  {
+    for(const auto& subtree: tree.subtrees)
+    {
+      if(subtree->instance_name == name || subtree->tree_ID == name)
+      {
+        AddSubtree(*subtree);
+      }
+    }
+  }
+  for(const auto& subtree: tree.subtrees)
+  {
+    AddSubtree(*subtree);
+  }
+
+  stop_prewarm_ = false;
+  prewarm_thread_ = std::thread([this, order = std::move(order)]()
+  {
+    for(const TreeNode* node: order)
+    {
+      if(stop_prewarm_)
+      {
+        return;
+      }
+      RosLazyEntity* entity = nullptr;
+      {
+        std::unique_lock lk(mutex_);
+        auto it = entities_.find(node);
+        if(it == entities_.end())
+        {
+          continue;
+        }
+        entity = it->second;
+        warming_up_ = entity;
+      }
+      // createClient() might wait for the server: the tree is not blocked meanwhile,
+      // unless it destroys this Node
+      try
+      {
+        entity->warmUp();
+      }
+      catch(std::exception&)
+      {
+        // the same error will be thrown again by tick()
+      }
+      {
+        std::unique_lock lk(mutex_);
+        warming_up_ = nullptr;
+      }
+      warm_up_done_.notify_all();
+    }
+  });
+}
+
+void RosEntityManager::waitPrewarm()
+{
+  if(prewarm_thread_.joinable())
+  {
+    prewarm_thread_.join();
+  }
+}
+
+size_t RosEntityManager::releaseIdle()
+{
+  if(idle_timeout_.count() <= 0)
+  {
+    return 0;
+  }
+  // scanning all the entities at each tick would be wasteful
+  const int64_t now = RosLazyEntity::steadyNow();
+  if(now - last_release_check_ < idle_timeout_.count() / 4)
+  {
+    return 0;
+  }
+  last_release_check_ = now;
+
+  std::unique_lock lk(mutex_);
+  size_t released = 0;
+  for(auto& [node, entity]: entities_)
+  {
+    // being created by the pre-warm thread
+    if(entity == warming_up_)
+    {
+      continue;
+    }
+    if(entity->releaseIfIdle(now, idle_timeout_))
+    {
+      released++;
+    }
+  }
+  return released;
+}
+
+}  // namespace BT
@@ -0,0 +1,397 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "behaviortree_ros2/ros_instrumentation.hpp"
+
+#include <algorithm>
+
+#include "behaviortree_cpp/tree_node.h"
+#include "behaviortree_ros2/msg/latency_statistics.hpp"
+#include "behaviortree_ros2/msg/tree_statistics.hpp"
+#include "behaviortree_ros2/srv/get_tree_statistics.hpp"
+
+#ifdef BT_ROS2_TRACEPOINTS
+#define TRACEPOINT_CREATE_PROBES
+#define TRACEPOINT_DEFINE
+#include "bt_ros2_tracepoints.h"
+#endif
+
+namespace BT
+{
+
+void LatencyHistogram::add(int64_t duration_ns)
+{
+  duration_ns = std::max<int64_t>(duration_ns, 0);
+
+  size_t index = 0;
+  while(index + 1 < kNumBuckets && duration_ns > bucketUpperBound(index))
+  {
+    index++;
+  }
+  buckets_[index].fetch_add(1, std::memory_order_relaxed);
+  sum_ns_.fetch_add(duration_ns, std::memory_order_relaxed);
+
+  int64_t prev = min_ns_.load(std::memory_order_relaxed);
+  while(duration_ns < prev && !min_ns_.compare_exchange_weak(prev, duration_ns, std::memory_order_relaxed)) {}
+  prev = max_ns_.load(std::memory_order_relaxed);
+  while(duration_ns > prev && !max_ns_.compare_exchange_weak(prev, duration_ns, std::memory_order_relaxed)) {}
+
+  // last, so that a snapshot never has count > 0 and an empty histogram
+  count_.fetch_add(1, std::memory_order_release);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+  Snapshot result;
+  result.count = count_.load(std::memory_order_acquire);
+  if(result.count == 0)
+  {
+    return result;
+  }
+  result.min_ns = min_ns_.load(std::memory_order_relaxed);
+  result.max_ns = max_ns_.load(std::memory_order_relaxed);
+  result.sum_ns = sum_ns_.load(std::memory_order_relaxed);
+  for(size_t i = 0; i < kNumBuckets; i++)
+  {
+    result.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+//----------------------------------------------------------------
+
+std::array<std::atomic<int64_t>, RosResourceCounters::NUM_RESOURCES>& RosResourceCounters::values()
+{
+  static std::array<std::atomic<int64_t>, NUM_RESOURCES> values = {};
+  return values;
+}
+
+void RosNodeStats::setServerName(const std::string& name)
+{
+  std::unique_lock lk(name_mutex_);
+  server_name_ = name;
+}
+
+std::string RosNodeStats::serverName() const
+{
+  std::unique_lock lk(name_mutex_);
+  return server_name_;
+}
+
+//----------------------------------------------------------------
+
+namespace
+{
+
+behaviortree_ros2::msg::LatencyHistogram ToMessage(const std::string& name, const std::string& metric,
+                                                   const LatencyHistogram::Snapshot& data)
+{
+  behaviortree_ros2::msg::LatencyHistogram histogram;
+  histogram.name = name;
+  histogram.metric = metric;
+  histogram.count = data.count;
+  if(data.count == 0)
+  {
+    return histogram;
+  }
+  histogram.min_ms = double(data.min_ns) * 1e-6;
+  histogram.max_ms = double(data.max_ns) * 1e-6;
+  histogram.mean_ms = double(data.sum_ns) * 1e-6 / double(data.count);
+  for(size_t i = 0; i < LatencyHistogram::kNumBuckets; i++)
+  {
+    histogram.bucket_upper_bounds_ms.push_back(double(LatencyHistogram::bucketUpperBound(i)) * 1e-6);
+    histogram.bucket_counts.push_back(data.buckets[i]);
+  }
+  return histogram;
+}
+
+behaviortree_ros2::msg::TreeStatistics ToMessage(std::vector<std::shared_ptr<RosNodeStats>> nodes,
+                                                 size_t max_nodes, const rclcpp::Time& stamp)
+{
+  using Resources = RosResourceCounters;
+  behaviortree_ros2::msg::TreeStatistics msg;
+  msg.stamp = stamp;
+  msg.clients = Resources::get(Resources::CLIENTS);
+  msg.callback_groups = Resources::get(Resources::CALLBACK_GROUPS);
+  msg.executors = Resources::get(Resources::EXECUTORS);
+  msg.subscriptions = Resources::get(Resources::SUBSCRIPTIONS);
+  msg.publishers = Resources::get(Resources::PUBLISHERS);
+
+  std::vector<LatencyHistogram::Snapshot> tick_durations;
+  tick_durations.reserve(nodes.size());
+  for(const auto& stats: nodes)
+  {
+    tick_durations.push_back(stats->tick_duration.snapshot());
+  }
+  // the slowest Nodes first
+  std::vector<size_t> order(nodes.size());
+  for(size_t i = 0; i < order.size(); i++)
+  {
+    order[i] = i;
+  }
+  if(max_nodes > 0 && max_nodes < nodes.size())
+  {
+    std::partial_sort(order.begin(), order.begin() + max_nodes, order.end(), [&](size_t a, size_t b) {
+      return tick_durations[a].sum_ns > tick_durations[b].sum_ns;
+    });
+    order.resize(max_nodes);
+  }
+
+  msg.nodes.reserve(order.size());
+  for(size_t index: order)
+  {
+    const auto& stats = *nodes[index];
+    behaviortree_ros2::msg::NodeStatistics node_msg;
+    node_msg.path = stats.path();
+    node_msg.type = stats.type();
+    node_msg.server_name = stats.serverName();
+    node_msg.server_reachable = stats.serverReachable();
+    node_msg.ticks = stats.get(RosNodeStats::TICKS);
+    node_msg.requests_sent = stats.get(RosNodeStats::REQUESTS_SENT);
+    node_msg.timeouts = stats.get(RosNodeStats::TIMEOUTS);
+    node_msg.cancels = stats.get(RosNodeStats::CANCELS);
+    node_msg.unreachable = stats.get(RosNodeStats::UNREACHABLE);
+    node_msg.messages_received = stats.get(RosNodeStats::MESSAGES_RECEIVED);
+    node_msg.messages_dropped = stats.get(RosNodeStats::MESSAGES_DROPPED);
+    node_msg.messages_published = stats.get(RosNodeStats::MESSAGES_PUBLISHED);
+    node_msg.tick_duration = ToMessage(stats.path(), "tick", tick_durations[index]);
+    node_msg.spin_duration = ToMessage(stats.path(), "spin_some", stats.spin_duration.snapshot());
+    msg.nodes.push_back(std::move(node_msg));
+  }
+  return msg;
+}
+
+}  // namespace
+
+RosInstrumentation::~RosInstrumentation()
+{
+  // the service must not be executed anymore
+  callback_guard_.release();
+  if(service_executor_ && service_callback_group_)
+  {
+    service_executor_->removeCallbackGroup(service_callback_group_);
+  }
+  {
+    std::unique_lock lk(publisher_mutex_);
+    stop_publishing_ = true;
+  }
+  publisher_cv_.notify_all();
+  for(auto& thread: publisher_threads_)
+  {
+    thread.join();
+  }
+}
+
+std::shared_ptr<LatencyHistogram> RosInstrumentation::histogram(const std::string& name,
+                                                                const std::string& metric)
+{
+  std::unique_lock lk(mutex_);
+  auto& histogram = histograms_[{name, metric}];
+  if(!histogram)
+  {
+    histogram = std::make_shared<LatencyHistogram>();
+  }
+  return histogram;
+}
+
+void RosInstrumentation::add(const std::string& name, const char* metric,
+                             int64_t start_ns, int64_t end_ns)
+{
+  // one of the events didn't happen
+  if(start_ns == 0 || end_ns == 0)
+  {
+    return;
+  }
+  histogram(name, metric)->add(end_ns - start_ns);
+#ifdef BT_ROS2_TRACEPOINTS
+  tracepoint(bt_ros2, latency, name.c_str(), metric, end_ns - start_ns);
+#endif
+}
+
+void RosInstrumentation::recordGoal(const std::string& action_name, const RequestTimestamps& stamps)
+{
+  const int64_t sent = stamps.sent;
+  const int64_t accepted = stamps.accepted;
+  const int64_t received = stamps.received;
+  const int64_t consumed = stamps.consumed;
+  add(action_name, "goal_accept", sent, accepted);
+  add(action_name, "first_feedback", accepted, stamps.first_feedback);
+  add(action_name, "goal_execution", accepted, received);
+  add(action_name, "result_tick_delay", received, consumed);
+  add(action_name, "goal_total", sent, consumed);
+}
+
+void RosInstrumentation::recordRequest(const std::string& service_name, const RequestTimestamps& stamps)
+{
+  const int64_t sent = stamps.sent;
+  const int64_t received = stamps.received;
+  const int64_t consumed = stamps.consumed;
+  add(service_name, "response", sent, received);
+  add(service_name, "response_tick_delay", received, consumed);
+  add(service_name, "request_total", sent, consumed);
+}
+
+void RosInstrumentation::recordMessageAge(const std::string& topic_name,
+                                          LatencyHistogram& histogram, int64_t age_ns)
+{
+  histogram.add(age_ns);
+#ifdef BT_ROS2_TRACEPOINTS
+  tracepoint(bt_ros2, latency, topic_name.c_str(), "message_age", age_ns);
+#else
+  (void)topic_name;
+#endif
+}
+
+std::vector<RosInstrumentation::Entry> RosInstrumentation::snapshot() const
+{
+  std::unique_lock lk(mutex_);
+  std::vector<Entry> entries;
+  entries.reserve(histograms_.size());
+  for(const auto& [key, histogram]: histograms_)
+  {
+    entries.push_back({key.first, key.second, histogram->snapshot()});
+  }
+  return entries;
+}
+
+std::shared_ptr<RosNodeStats> RosInstrumentation::registerNode(const TreeNode& node, const char* type)
+{
+  auto stats = std::make_shared<RosNodeStats>(node.fullPath().empty() ? node.name() : node.fullPath(), type);
+  std::unique_lock lk(mutex_);
+  // trees created and destroyed repeatedly don't grow nodes_ without bounds, even
+  // if nodeSnapshot() is never invoked. The threshold doubles, to prune in amortized O(1)
+  if(nodes_.size() >= nodes_prune_size_)
+  {
+    nodes_.erase(std::remove_if(nodes_.begin(), nodes_.end(),
+                                [](const std::weak_ptr<RosNodeStats>& weak) { return weak.expired(); }),
+                 nodes_.end());
+    nodes_prune_size_ = std::max<size_t>(64, 2 * nodes_.size());
+  }
+  nodes_.push_back(stats);
+  return stats;
+}
+
+std::vector<std::shared_ptr<RosNodeStats>> RosInstrumentation::nodeSnapshot() const
+{
+  std::unique_lock lk(mutex_);
+  std::vector<std::shared_ptr<RosNodeStats>> nodes;
+  nodes.reserve(nodes_.size());
+  auto it = std::remove_if(nodes_.begin(), nodes_.end(), [&nodes](const std::weak_ptr<RosNodeStats>& weak) {
+    auto stats = weak.lock();
+    if(!stats) {
+      return true;
+    }
+    nodes.push_back(std::move(stats));
+    return false;
+  });
+  nodes_.erase(it, nodes_.end());
+  return nodes;
+}
+
+void RosInstrumentation::startService(const std::shared_ptr<rclcpp::Node>& node,
+                                      const std::shared_ptr<RosBackgroundExecutor>& background_executor,
+                                      const std::string& service_name)
+{
+  using behaviortree_ros2::srv::GetTreeStatistics;
+
+  if(service_)
+  {
+    throw std::logic_error("RosInstrumentation::startService() called twice");
+  }
+  if(background_executor)
+  {
+    service_callback_group_ = node->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive, false);
+  }
+  auto clock = node->get_clock();
+  auto callback = [this, clock, token = callback_guard_.token()]
+    (const std::shared_ptr<GetTreeStatistics::Request> request,
+     std::shared_ptr<GetTreeStatistics::Response> response)
+  {
+    auto lock = token.lock();
+    if(lock) {
+      response->statistics = ToMessage(nodeSnapshot(), request->max_nodes, clock->now());
+    }
+  };
+  service_ = node->create_service<GetTreeStatistics>(service_name, callback, rmw_qos_profile_services_default,
+                                                     service_callback_group_);
+  if(background_executor)
+  {
+    service_executor_ = background_executor;
+    background_executor->addCallbackGroup(service_callback_group_, node->get_node_base_interface());
+  }
+}
+
+void RosInstrumentation::startThread(std::function<void()> publish, std::chrono::milliseconds period)
+{
+  publisher_threads_.emplace_back([this, publish = std::move(publish), period]()
+  {
+    std::unique_lock lk(publisher_mutex_);
+    while(!publisher_cv_.wait_for(lk, period, [this]() { return stop_publishing_; }))
+    {
+      publish();
+    }
+  });
+}
+
+void RosInstrumentation::startPublishing(const std::shared_ptr<rclcpp::Node>& node,
+                                         const std::string& topic_name,
+                                         std::chrono::milliseconds period)
+{
+  using behaviortree_ros2::msg::LatencyStatistics;
+
+  std::unique_lock lk(publisher_mutex_);
+  if(std::exchange(publishing_histograms_, true))
+  {
+    throw std::logic_error("RosInstrumentation::startPublishing() called twice");
+  }
+  auto publisher = node->create_publisher<LatencyStatistics>(topic_name, rclcpp::QoS(1));
+  auto clock = node->get_clock();
+
+  startThread([this, publisher, clock]()
+  {
+    LatencyStatistics msg;
+    msg.stamp = clock->now();
+    for(const auto& entry: snapshot())
+    {
+      if(entry.data.count == 0) {
+        continue;
+      }
+      msg.histograms.push_back(ToMessage(entry.name, entry.metric, entry.data));
+    }
+    publisher->publish(msg);
+  }, period);
+}
+
+void RosInstrumentation::startPublishingNodes(const std::shared_ptr<rclcpp::Node>& node,
+                                              const std::string& topic_name,
+                                              std::chrono::milliseconds period,
+                                              size_t max_nodes)
+{
+  using behaviortree_ros2::msg::TreeStatistics;
+
+  std::unique_lock lk(publisher_mutex_);
+  if(std::exchange(publishing_nodes_, true))
+  {
+    throw std::logic_error("RosInstrumentation::startPublishingNodes() called twice");
+  }
+  auto publisher = node->create_publisher<TreeStatistics>(topic_name, rclcpp::QoS(1));
+  auto clock = node->get_clock();
+
+  startThread([this, publisher, clock, max_nodes]()
+  {
+    publisher->publish(ToMessage(nodeSnapshot(), max_nodes, clock->now()));
+  }, period);
+}
+
+}  // namespace BT
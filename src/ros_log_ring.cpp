@@ -0,0 +1,171 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "behaviortree_ros2/ros_log_ring.hpp"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <rclcpp/rclcpp.hpp>
+
+namespace BT
+{
+
+namespace
+{
+
+size_t roundUpToPowerOfTwo(size_t value)
+{
+  size_t result = 1;
+  while(result < value)
+  {
+    result <<= 1;
+  }
+  return result;
+}
+
+int64_t steadyNow()
+{
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+}  // namespace
+
+RosLogRing::RosLogRing(size_t capacity,
+                       std::chrono::milliseconds flush_period,
+                       std::chrono::milliseconds throttle_period):
+  mask_(roundUpToPowerOfTwo(std::max<size_t>(capacity, 2)) - 1),
+  throttle_period_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(throttle_period).count()),
+  slots_(new Slot[mask_ + 1])
+{
+  for(size_t i = 0; i <= mask_; i++)
+  {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  thread_ = std::thread([this, flush_period]() {
+    std::unique_lock lk(thread_mutex_);
+    while(!stop_)
+    {
+      thread_cv_.wait_for(lk, flush_period);
+      flush();
+    }
+  });
+}
+
+RosLogRing::~RosLogRing()
+{
+  {
+    std::unique_lock lk(thread_mutex_);
+    stop_ = true;
+  }
+  thread_cv_.notify_all();
+  thread_.join();
+  flush();
+}
+
+bool RosLogRing::log(RosLogThrottle& source, int severity, const char* logger_name,
+                     const char* format, ...)
+{
+  auto& throttle = source.get(severity);
+  // only the thread that moves next_time forward logs the message
+  const int64_t now = steadyNow();
+  int64_t next_time = throttle.next_time.load(std::memory_order_relaxed);
+  if(now < next_time ||
+     !throttle.next_time.compare_exchange_strong(next_time, now + throttle_period_))
+  {
+    throttle.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  // bounded multi-producer queue, see "Bounded MPMC queue" by Dmitry Vyukov
+  size_t pos = write_pos_.load(std::memory_order_relaxed);
+  Slot* slot = nullptr;
+  while(true)
+  {
+    slot = &slots_[pos & mask_];
+    const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if(diff == 0)
+    {
+      if(write_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if(diff < 0)
+    {
+      // full: the message is lost, but not the count of the suppressed ones
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    else {
+      pos = write_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->severity = severity;
+  std::strncpy(slot->logger_name, logger_name, kLoggerNameSize - 1);
+  slot->logger_name[kLoggerNameSize - 1] = '\0';
+
+  va_list args;
+  va_start(args, format);
+  int length = std::vsnprintf(slot->text, kTextSize, format, args);
+  va_end(args);
+
+  const uint32_t suppressed = throttle.suppressed.exchange(0, std::memory_order_relaxed);
+  if(suppressed > 0 && length >= 0 && static_cast<size_t>(length) < kTextSize)
+  {
+    std::snprintf(slot->text + length, kTextSize - length,
+                  " [%u similar messages suppressed]", suppressed);
+  }
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+void RosLogRing::flush()
+{
+  std::unique_lock lk(flush_mutex_);
+  while(true)
+  {
+    Slot& slot = slots_[read_pos_ & mask_];
+    if(slot.sequence.load(std::memory_order_acquire) != read_pos_ + 1)
+    {
+      return;
+    }
+    const auto logger = rclcpp::get_logger(slot.logger_name);
+    switch(slot.severity)
+    {
+      case RCUTILS_LOG_SEVERITY_DEBUG:
+        RCLCPP_DEBUG(logger, "%s", slot.text);
+        break;
+      case RCUTILS_LOG_SEVERITY_WARN:
+        RCLCPP_WARN(logger, "%s", slot.text);
+        break;
+      case RCUTILS_LOG_SEVERITY_ERROR:
+        RCLCPP_ERROR(logger, "%s", slot.text);
+        break;
+      case RCUTILS_LOG_SEVERITY_FATAL:
+        RCLCPP_FATAL(logger, "%s", slot.text);
+        break;
+      default:
+        RCLCPP_INFO(logger, "%s", slot.text);
+    }
+    slot.sequence.store(read_pos_ + mask_ + 1, std::memory_order_release);
+    read_pos_++;
+  }
+}
+
+}  // namespace BT
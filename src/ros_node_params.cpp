@@ -0,0 +1,58 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "behaviortree_ros2/ros_node_params.hpp"
+
+#include "behaviortree_cpp/tree_node.h"
+
+namespace BT
+{
+
+std::string GetStaticPortName(const TreeNode& node,
+                              const std::string& port_name,
+                              const RosNodeParams& params)
+{
+  auto portIt = node.config().input_ports.find(port_name);
+  if(portIt != node.config().input_ports.end())
+  {
+    const std::string& bb_name = portIt->second;
+    if(!bb_name.empty() && bb_name != "__default__placeholder__")
+    {
+      // If the content of the port is not a pointer to the blackboard,
+      // but a static string, the client can be created in the constructor.
+      return TreeNode::isBlackboardPointer(bb_name) ? std::string() : bb_name;
+    }
+  }
+  if(params.default_port_value.empty())
+  {
+    throw std::logic_error(
+      "Both [" + port_name + "] in the InputPort and the RosNodeParams are empty.");
+  }
+  return params.default_port_value;
+}
+
+bool UsesIntraProcess(const rclcpp::Node& node, rclcpp::IntraProcessSetting setting)
+{
+  switch(setting)
+  {
+    case rclcpp::IntraProcessSetting::Enable:
+      return true;
+    case rclcpp::IntraProcessSetting::Disable:
+      return false;
+    default:
+      return node.get_node_options().use_intra_process_comms();
+  }
+}
+
+}  // namespace BT
@@ -0,0 +1,150 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "behaviortree_ros2/ros_parameter_cache.hpp"
+
+#include <map>
+
+namespace BT
+{
+
+RosParameterCache::RosParameterCache(std::shared_ptr<rclcpp::Node> node,
+                                     std::shared_ptr<RosBackgroundExecutor> background_executor):
+  node_(std::move(node)),
+  background_executor_(std::move(background_executor))
+{
+  callback_group_ = node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive, false);
+  rclcpp::SubscriptionOptions sub_option;
+  sub_option.callback_group = callback_group_;
+  auto callback = [this, token = callback_guard_.token()](const rcl_interfaces::msg::ParameterEvent& event)
+  {
+    auto lock = token.lock();
+    if(lock) {
+      onEvent(event);
+    }
+  };
+  subscriber_ = node_->create_subscription<rcl_interfaces::msg::ParameterEvent>(
+    "/parameter_events", rclcpp::ParameterEventsQoS(), callback, sub_option);
+
+  if(background_executor_)
+  {
+    background_executor_->addCallbackGroup(callback_group_, node_->get_node_base_interface());
+  }
+  else {
+    executor_ = std::make_unique<rclcpp::executors::SingleThreadedExecutor>();
+    executor_->add_callback_group(callback_group_, node_->get_node_base_interface());
+  }
+}
+
+std::shared_ptr<RosParameterCache> RosParameterCache::shared(
+  const std::shared_ptr<rclcpp::Node>& node,
+  const std::shared_ptr<RosBackgroundExecutor>& background_executor)
+{
+  static std::mutex mutex;
+  // the cache keeps the node alive: an address can't be reused while its cache exists
+  static std::map<const rclcpp::Node*, std::weak_ptr<RosParameterCache>> caches;
+
+  std::unique_lock lk(mutex);
+  for(auto it = caches.begin(); it != caches.end();)
+  {
+    it = it->second.expired() ? caches.erase(it) : std::next(it);
+  }
+  auto& weak_cache = caches[node.get()];
+  auto cache = weak_cache.lock();
+  if(!cache)
+  {
+    cache = std::make_shared<RosParameterCache>(node, background_executor);
+    weak_cache = cache;
+  }
+  return cache;
+}
+
+RosParameterCache::~RosParameterCache()
+{
+  callback_guard_.release();
+  if(background_executor_)
+  {
+    background_executor_->removeCallbackGroup(callback_group_);
+  }
+}
+
+void RosParameterCache::spinSome()
+{
+  // the cache might be shared by trees ticked by different threads
+  std::unique_lock lk(spin_mutex_, std::try_to_lock);
+  if(executor_ && lk.owns_lock())
+  {
+    executor_->spin_some();
+  }
+}
+
+bool RosParameterCache::lookup(const std::string& node_name, const std::string& parameter,
+                               ParameterValue& value)
+{
+  std::unique_lock lk(mutex_);
+  auto& parameters = nodes_[node_name];
+  auto it = parameters.find(parameter);
+  if(it == parameters.end())
+  {
+    return false;
+  }
+  value = it->second;
+  return true;
+}
+
+void RosParameterCache::store(const std::string& node_name, const std::string& parameter,
+                              const ParameterValue& value)
+{
+  std::unique_lock lk(mutex_);
+  // if it is there already, it was written by an event received after the request
+  nodes_[node_name].try_emplace(parameter, value);
+}
+
+size_t RosParameterCache::size() const
+{
+  std::unique_lock lk(mutex_);
+  size_t count = 0;
+  for(const auto& [name, parameters]: nodes_)
+  {
+    count += parameters.size();
+  }
+  return count;
+}
+
+void RosParameterCache::onEvent(const rcl_interfaces::msg::ParameterEvent& event)
+{
+  std::unique_lock lk(mutex_);
+  auto it = nodes_.find(event.node);
+  if(it == nodes_.end())
+  {
+    // nobody is interested in this node
+    return;
+  }
+  auto& parameters = it->second;
+  for(const auto& parameter: event.new_parameters)
+  {
+    parameters[parameter.name] = parameter.value;
+  }
+  for(const auto& parameter: event.changed_parameters)
+  {
+    parameters[parameter.name] = parameter.value;
+  }
+  for(const auto& parameter: event.deleted_parameters)
+  {
+    parameters[parameter.name] = ParameterValue();
+  }
+}
+
+}  // namespace BT
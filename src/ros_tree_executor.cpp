@@ -0,0 +1,80 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "behaviortree_ros2/ros_tree_executor.hpp"
+
+namespace BT
+{
+
+RosTreeExecutor::RosTreeExecutor():
+  RosTreeExecutor(Options())
+{}
+
+RosTreeExecutor::RosTreeExecutor(const Options& options):
+  options_(options),
+  background_executor_(std::make_shared<RosBackgroundExecutor>(options.num_threads))
+{}
+
+std::shared_ptr<RosBackgroundExecutor> RosTreeExecutor::backgroundExecutor() const
+{
+  return background_executor_;
+}
+
+NodeStatus RosTreeExecutor::tickWhileRunning(Tree& tree)
+{
+  {
+    std::unique_lock lk(tree_mutex_);
+    running_tree_ = &tree;
+  }
+
+  NodeStatus status = tree.tickOnce();
+
+  while(status == NodeStatus::RUNNING && !stop_requested_ && rclcpp::ok())
+  {
+    // interrupted by TreeNode::emitWakeUpSignal()
+    tree.sleep(options_.max_sleep);
+    if(stop_requested_ || !rclcpp::ok())
+    {
+      break;
+    }
+    status = tree.tickOnce();
+    if(options_.entity_manager)
+    {
+      options_.entity_manager->releaseIdle();
+    }
+  }
+
+  if(status == NodeStatus::RUNNING)
+  {
+    tree.haltTree();
+  }
+
+  std::unique_lock lk(tree_mutex_);
+  running_tree_ = nullptr;
+  // reset here, not at the beginning, so that a stop() invoked before this call is not lost
+  stop_requested_ = false;
+  return status;
+}
+
+void RosTreeExecutor::stop()
+{
+  stop_requested_ = true;
+  std::unique_lock lk(tree_mutex_);
+  if(running_tree_ && running_tree_->rootNode())
+  {
+    running_tree_->rootNode()->emitWakeUpSignal();
+  }
+}
+
+}  // namespace BT
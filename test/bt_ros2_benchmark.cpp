@@ -0,0 +1,480 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the hot paths of the wrappers, against in-process servers.
+//
+// Most benchmarks take as last argument the configuration of RosNodeParams:
+//
+//   0: default, one client and executor per Node, spun in tick()
+//   1: RosNodeParams::share_clients
+//   2: RosNodeParams::background_executor
+//   3: RosNodeParams::realtime (with background_executor and log_ring)
+//
+// The counter "allocs_per_tick" counts the calls to operator new issued by
+// all the threads of the process (including the executors) during the ticks.
+//
+// BM_ActionTickRealtime fails if the thread of the tree allocates memory
+// in any tick of the RUNNING Nodes, after the warm-up; the same check is
+// executed by the unit test test_realtime_tick.
+//
+// Usage:
+//
+//    ros2 run behaviortree_ros2 bt_ros2_benchmark --benchmark_filter=ActionTick
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <rclcpp/rclcpp.hpp>
+#include <rclcpp_action/rclcpp_action.hpp>
+#include <builtin_interfaces/msg/time.hpp>
+#include <rcl_interfaces/srv/get_parameters.hpp>
+
+#include "behaviortree_cpp/bt_factory.h"
+#include "behaviortree_ros2/action/sleep.hpp"
+#include "behaviortree_ros2/bt_action_node.hpp"
+#include "behaviortree_ros2/bt_service_node.hpp"
+#include "behaviortree_ros2/bt_topic_sub_node.hpp"
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/ros_log_ring.hpp"
+
+//-------------------------------------------------------------
+// Allocations counter
+//-------------------------------------------------------------
+
+static std::atomic<uint64_t> allocations_count{0};
+// allocations of the current thread only
+static thread_local uint64_t thread_allocations_count = 0;
+
+void* operator new(std::size_t size)
+{
+  allocations_count.fetch_add(1, std::memory_order_relaxed);
+  thread_allocations_count++;
+  if(void* ptr = std::malloc(size > 0 ? size : 1))
+  {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+using namespace BT;
+using Sleep = behaviortree_ros2::action::Sleep;
+using GetParameters = rcl_interfaces::srv::GetParameters;
+using TimeMsg = builtin_interfaces::msg::Time;
+
+//-------------------------------------------------------------
+// In-process servers
+//-------------------------------------------------------------
+
+class BenchmarkServer : public rclcpp::Node
+{
+public:
+  using GoalHandleSleep = rclcpp_action::ServerGoalHandle<Sleep>;
+
+  BenchmarkServer() : Node("bt_ros2_benchmark_server")
+  {
+    // goals with msec_timeout == 0 succeed immediately, the others never complete
+    action_server_ = rclcpp_action::create_server<Sleep>(
+      this, "benchmark_sleep",
+      [](const rclcpp_action::GoalUUID&, std::shared_ptr<const Sleep::Goal>) {
+        return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
+      },
+      [](const std::shared_ptr<GoalHandleSleep>) {
+        return rclcpp_action::CancelResponse::ACCEPT;
+      },
+      [this](const std::shared_ptr<GoalHandleSleep> goal_handle) {
+        if(goal_handle->get_goal()->msec_timeout == 0)
+        {
+          auto result = std::make_shared<Sleep::Result>();
+          result->done = true;
+          goal_handle->succeed(result);
+          return;
+        }
+        std::unique_lock lk(mutex_);
+        running_goals_.push_back(goal_handle);
+      });
+
+    cancel_timer_ = create_wall_timer(std::chrono::milliseconds(10), [this]() {
+      std::unique_lock lk(mutex_);
+      for(auto it = running_goals_.begin(); it != running_goals_.end(); )
+      {
+        if((*it)->is_canceling())
+        {
+          (*it)->canceled(std::make_shared<Sleep::Result>());
+          it = running_goals_.erase(it);
+        }
+        else {
+          it++;
+        }
+      }
+    });
+
+    fast_service_ = create_service<GetParameters>(
+      "benchmark_fast_service",
+      [](const std::shared_ptr<GetParameters::Request>, std::shared_ptr<GetParameters::Response>) {});
+
+    // the response is never sent: the RosServiceNode stays RUNNING
+    slow_service_ = create_service<GetParameters>(
+      "benchmark_slow_service",
+      [](const std::shared_ptr<rmw_request_id_t>, const std::shared_ptr<GetParameters::Request>) {});
+
+    publisher_ = create_publisher<TimeMsg>("benchmark_topic", rclcpp::QoS(1));
+    publish_timer_ = create_wall_timer(std::chrono::milliseconds(1), [this]() {
+      publisher_->publish(TimeMsg());
+    });
+  }
+
+private:
+  std::mutex mutex_;
+  rclcpp_action::Server<Sleep>::SharedPtr action_server_;
+  std::vector<std::shared_ptr<GoalHandleSleep>> running_goals_;
+  rclcpp::TimerBase::SharedPtr cancel_timer_;
+  rclcpp::Service<GetParameters>::SharedPtr fast_service_;
+  rclcpp::Service<GetParameters>::SharedPtr slow_service_;
+  rclcpp::Publisher<TimeMsg>::SharedPtr publisher_;
+  rclcpp::TimerBase::SharedPtr publish_timer_;
+};
+
+//-------------------------------------------------------------
+// Wrappers
+//-------------------------------------------------------------
+
+class BenchmarkSleep : public RosActionNode<Sleep>
+{
+public:
+  BenchmarkSleep(const std::string& name, const NodeConfig& conf, const RosNodeParams& params)
+    : RosActionNode<Sleep>(name, conf, params)
+  {}
+
+  static PortsList providedPorts()
+  {
+    return providedBasicPorts({InputPort<unsigned>("msec")});
+  }
+
+  bool setGoal(Goal& goal) override
+  {
+    goal.msec_timeout = getInput<unsigned>("msec").value();
+    return true;
+  }
+
+  NodeStatus onResultReceived(const WrappedResult& wr) override
+  {
+    return wr.result->done ? NodeStatus::SUCCESS : NodeStatus::FAILURE;
+  }
+};
+
+class BenchmarkService : public ROS::RosServiceNode<GetParameters>
+{
+public:
+  BenchmarkService(const std::string& name, const NodeConfig& conf, const RosNodeParams& params)
+    : ROS::RosServiceNode<GetParameters>(name, conf, params)
+  {}
+
+  bool setRequest(Request::SharedPtr& request) override
+  {
+    request->names.clear();
+    return true;
+  }
+
+  NodeStatus onResponseReceived(const Response::SharedPtr&) override
+  {
+    return NodeStatus::SUCCESS;
+  }
+};
+
+class BenchmarkTopic : public RosTopicSubNode<TimeMsg>
+{
+public:
+  BenchmarkTopic(const std::string& name, const NodeConfig& conf, const RosNodeParams& params)
+    : RosTopicSubNode<TimeMsg>(name, conf, params)
+  {}
+
+  NodeStatus onTick(const TimeMsg::SharedPtr&) override
+  {
+    return NodeStatus::SUCCESS;
+  }
+};
+
+//-------------------------------------------------------------
+// Environment
+//-------------------------------------------------------------
+
+struct BenchmarkEnvironment
+{
+  std::shared_ptr<BenchmarkServer> server;
+  std::shared_ptr<rclcpp::Node> client_node;
+  std::shared_ptr<RosBackgroundExecutor> background_executor;
+  std::shared_ptr<RosLogRing> log_ring;
+  rclcpp::executors::SingleThreadedExecutor server_executor;
+  std::thread server_thread;
+
+  BenchmarkEnvironment()
+  {
+    server = std::make_shared<BenchmarkServer>();
+    client_node = std::make_shared<rclcpp::Node>("bt_ros2_benchmark_client");
+    background_executor = std::make_shared<RosBackgroundExecutor>();
+    log_ring = std::make_shared<RosLogRing>();
+    server_executor.add_node(server);
+    server_thread = std::thread([this]() { server_executor.spin(); });
+  }
+
+  ~BenchmarkEnvironment()
+  {
+    server_executor.cancel();
+    server_thread.join();
+  }
+
+  static BenchmarkEnvironment& get()
+  {
+    static BenchmarkEnvironment env;
+    return env;
+  }
+
+  RosNodeParams params(int64_t mode) const
+  {
+    RosNodeParams params;
+    params.nh = client_node;
+    // the Nodes of BM_ActionTick and BM_ServiceTick must not time out
+    params.server_timeout = std::chrono::minutes(5);
+    params.share_clients = (mode == 1);
+    if(mode >= 2)
+    {
+      params.background_executor = background_executor;
+    }
+    if(mode == 3)
+    {
+      params.log_ring = log_ring;
+      params.realtime = true;
+    }
+    return params;
+  }
+
+  BehaviorTreeFactory factory(int64_t mode) const
+  {
+    BehaviorTreeFactory factory;
+    auto action_params = params(mode);
+    action_params.default_port_value = "benchmark_sleep";
+    factory.registerNodeType<BenchmarkSleep>("BenchmarkSleep", action_params);
+
+    auto slow_params = params(mode);
+    slow_params.default_port_value = "benchmark_slow_service";
+    factory.registerNodeType<BenchmarkService>("BenchmarkSlowService", slow_params);
+
+    auto fast_params = params(mode);
+    fast_params.default_port_value = "benchmark_fast_service";
+    factory.registerNodeType<BenchmarkService>("BenchmarkFastService", fast_params);
+
+    auto topic_params = params(mode);
+    topic_params.default_port_value = "benchmark_topic";
+    factory.registerNodeType<BenchmarkTopic>("BenchmarkTopic", topic_params);
+    return factory;
+  }
+};
+
+// N instances of the same Node, under a Parallel
+static std::string ParallelTreeXML(const std::string& node, int64_t count)
+{
+  std::ostringstream xml;
+  xml << R"(<root BTCPP_format="4"><BehaviorTree ID="Main">)"
+      << R"(<Parallel success_count="-1" failure_count="1">)";
+  for(int64_t i = 0; i < count; i++)
+  {
+    xml << "<" << node << "/>";
+  }
+  xml << "</Parallel></BehaviorTree></root>";
+  return xml.str();
+}
+
+// tick for a while, until the goals / requests of all the Nodes were sent and accepted
+static void WarmUp(Tree& tree)
+{
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+  while(std::chrono::steady_clock::now() < deadline)
+  {
+    tree.tickOnce();
+    tree.sleep(std::chrono::milliseconds(1));
+  }
+}
+
+static void CountAllocations(benchmark::State& state, uint64_t allocations)
+{
+  state.counters["allocs_per_tick"] =
+    benchmark::Counter(double(allocations), benchmark::Counter::kAvgIterations);
+}
+
+//-------------------------------------------------------------
+// Per-tick cost of RUNNING Nodes
+//-------------------------------------------------------------
+
+static void TickRunningNodes(benchmark::State& state, const std::string& node, const std::string& attributes)
+{
+  auto& env = BenchmarkEnvironment::get();
+  auto factory = env.factory(state.range(1));
+  auto tree = factory.createTreeFromText(ParallelTreeXML(node + " " + attributes, state.range(0)));
+  WarmUp(tree);
+
+  uint64_t allocations = 0;
+  for(auto _ : state)
+  {
+    const uint64_t before = allocations_count.load(std::memory_order_relaxed);
+    benchmark::DoNotOptimize(tree.tickOnce());
+    allocations += allocations_count.load(std::memory_order_relaxed) - before;
+  }
+  CountAllocations(state, allocations);
+  state.counters["nodes"] = double(state.range(0));
+  tree.haltTree();
+}
+
+static void BM_ActionTick(benchmark::State& state)
+{
+  TickRunningNodes(state, "BenchmarkSleep", "msec=\"1000000\"");
+}
+
+static void BM_ActionTickRealtime(benchmark::State& state)
+{
+  auto& env = BenchmarkEnvironment::get();
+  auto factory = env.factory(3);
+  auto tree = factory.createTreeFromText(
+    ParallelTreeXML("BenchmarkSleep msec=\"1000000\"", state.range(0)));
+  WarmUp(tree);
+
+  uint64_t allocations = 0;
+  for(auto _ : state)
+  {
+    const uint64_t before = thread_allocations_count;
+    benchmark::DoNotOptimize(tree.tickOnce());
+    allocations += thread_allocations_count - before;
+  }
+  CountAllocations(state, allocations);
+  state.counters["nodes"] = double(state.range(0));
+  tree.haltTree();
+  if(allocations > 0)
+  {
+    state.SkipWithError("tick() allocated memory in realtime mode");
+  }
+}
+
+static void BM_ServiceTick(benchmark::State& state)
+{
+  TickRunningNodes(state, "BenchmarkSlowService", "");
+}
+
+static void BM_TopicTick(benchmark::State& state)
+{
+  TickRunningNodes(state, "BenchmarkTopic", "");
+}
+
+//-------------------------------------------------------------
+// Round trip: from the first tick to SUCCESS
+//-------------------------------------------------------------
+
+static void RoundTrip(benchmark::State& state, const std::string& node)
+{
+  auto& env = BenchmarkEnvironment::get();
+  auto factory = env.factory(state.range(0));
+  auto tree = factory.createTreeFromText(ParallelTreeXML(node, 1));
+
+  uint64_t allocations = 0;
+  for(auto _ : state)
+  {
+    const uint64_t before = allocations_count.load(std::memory_order_relaxed);
+    // when the background executor is used, the tree is woken up by the callbacks
+    if(tree.tickWhileRunning(std::chrono::milliseconds(1)) != NodeStatus::SUCCESS)
+    {
+      state.SkipWithError("the Node failed");
+      break;
+    }
+    allocations += allocations_count.load(std::memory_order_relaxed) - before;
+  }
+  state.counters["allocs_per_call"] =
+    benchmark::Counter(double(allocations), benchmark::Counter::kAvgIterations);
+}
+
+static void BM_ActionRoundTrip(benchmark::State& state)
+{
+  RoundTrip(state, "BenchmarkSleep msec=\"0\"");
+}
+
+static void BM_ServiceRoundTrip(benchmark::State& state)
+{
+  RoundTrip(state, "BenchmarkFastService");
+}
+
+//-------------------------------------------------------------
+// Construction of a tree with N Nodes
+//-------------------------------------------------------------
+
+static void BM_ActionTreeConstruction(benchmark::State& state)
+{
+  auto& env = BenchmarkEnvironment::get();
+  auto factory = env.factory(state.range(1));
+  const auto xml = ParallelTreeXML("BenchmarkSleep msec=\"0\"", state.range(0));
+
+  std::optional<Tree> tree;
+  for(auto _ : state)
+  {
+    tree.emplace(factory.createTreeFromText(xml));
+    benchmark::DoNotOptimize(tree->rootNode());
+    state.PauseTiming();
+    tree.reset();
+    state.ResumeTiming();
+  }
+  state.counters["nodes"] = double(state.range(0));
+}
+
+static void NodeCountsAndModes(benchmark::internal::Benchmark* bench)
+{
+  for(int64_t mode: {0, 1, 2, 3})
+  {
+    for(int64_t count: {1, 10, 100, 1000})
+    {
+      bench->Args({count, mode});
+    }
+  }
+}
+
+BENCHMARK(BM_ActionTick)->Apply(NodeCountsAndModes);
+BENCHMARK(BM_ActionTickRealtime)->Arg(1)->Arg(10)->Arg(100)->Arg(1000);
+BENCHMARK(BM_ServiceTick)->Apply(NodeCountsAndModes);
+BENCHMARK(BM_TopicTick)->Apply(NodeCountsAndModes);
+BENCHMARK(BM_ActionRoundTrip)->Arg(0)->Arg(1)->Arg(2)->Arg(3)->UseRealTime();
+BENCHMARK(BM_ServiceRoundTrip)->Arg(0)->Arg(1)->Arg(2)->UseRealTime();
+BENCHMARK(BM_ActionTreeConstruction)->Apply(NodeCountsAndModes)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+  rclcpp::init(argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  rclcpp::shutdown();
+  return 0;
+}
@@ -1,6 +1,9 @@
-#include <behaviortree_ros2/bt_action_node.hpp>
+#include "behaviortree_ros2/bt_action_node.hpp"
 #include "behaviortree_ros2/action/sleep.hpp"
 
+// RosActionNode<Sleep> is already compiled in bt_ros2 (see bt_ros2_instantiations.hpp)
+extern template class BT::RosActionNode<behaviortree_ros2::action::Sleep>;
+
 using namespace BT;
 
 class SleepAction: public RosActionNode<behaviortree_ros2::action::Sleep>
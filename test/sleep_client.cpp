@@ -3,6 +3,7 @@
 #include <rclcpp/executors.hpp>
 
 #include "behaviortree_ros2/plugins.hpp"
+#include "behaviortree_ros2/ros_tree_executor.hpp"
 
 #ifndef USE_SLEEP_PLUGIN
 #include "sleep_action.hpp"
@@ -67,9 +68,13 @@ int main(int argc, char **argv)
 
   factory.registerNodeType<PrintValue>("PrintValue");
 
+  // the tree is ticked only when the action server sends a result or a feedback
+  RosTreeExecutor tree_executor;
+
   RosNodeParams params;
   params.nh = nh;
   params.default_port_value = "sleep_service";
+  params.background_executor = tree_executor.backgroundExecutor();
 
 #ifdef USE_SLEEP_PLUGIN
   RegisterRosNode(factory, "../lib/libsleep_action_plugin.so", params);
@@ -79,7 +84,7 @@ int main(int argc, char **argv)
 
   auto tree = factory.createTreeFromText(xml_text);
 
-  tree.tickWhileRunning();
+  tree_executor.tickWhileRunning(tree);
 
   return 0;
 }
@@ -1,93 +1,330 @@
+// Mock action and service server, used by the Sleep example and for load testing
+// the wrappers. By default it behaves as the original Sleep server: a single action
+// "sleep_service" that succeeds after goal.msec_timeout, with feedback at 5 Hz.
+//
+// All the goals are executed by the thread of BT::DeadlineScheduler, so it can host
+// thousands of concurrent goals. Parameters:
+//
+//   action_names         (string[])  Sleep action servers          ["sleep_service"]
+//   service_names        (string[])  std_srvs/Trigger services     []
+//   threads              (int)       threads of the executor, 0 for
+//                                    the number of hardware threads 0
+//   accept_latency_ms    (int)       delay before accepting a goal; it blocks
+//                                    a thread of the executor, therefore
+//                                    threads must be at least the number of
+//                                    concurrent goal requests      0
+//   feedback_rate        (double)    Hz, 0 to disable feedback     5.0
+//   result_latency_ms    (int)       duration of a goal; if negative,
+//                                    goal.msec_timeout is used     -1
+//   reject_probability   (double)    goals rejected / responses
+//                                    with success=false            0.0
+//   abort_probability    (double)    goals aborted                 0.0
+//   service_latency_ms   (int)       delay of the responses        0
+//   verbose              (bool)      log every goal and feedback   false
+//   stats_period_s       (double)    period of the statistics, 0 to disable  5.0
+//
+// For instance:
+//
+//   ros2 run behaviortree_ros2 sleep_server --ros-args -p threads:=4 \
+//     -p action_names:="[sleep_a, sleep_b]" -p service_names:="[trigger]" \
+//     -p feedback_rate:=50.0 -p reject_probability:=0.01
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <thread>
+#include <vector>
 
 #include "rclcpp/rclcpp.hpp"
 #include "rclcpp_action/rclcpp_action.hpp"
+#include "std_srvs/srv/trigger.hpp"
 #include "behaviortree_ros2/action/sleep.hpp"
-
-#include "behaviortree_ros2/bt_action_node.hpp"
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/ros_deadline.hpp"
 
 class SleepActionServer : public rclcpp::Node
 {
 public:
   using Sleep = behaviortree_ros2::action::Sleep;
   using GoalHandleSleep = rclcpp_action::ServerGoalHandle<Sleep>;
+  using Trigger = std_srvs::srv::Trigger;
+  using Clock = std::chrono::steady_clock;
 
   explicit SleepActionServer(const rclcpp::NodeOptions & options = rclcpp::NodeOptions())
     : Node("sleep_action_server", options)
   {
     using namespace std::placeholders;
 
-    this->action_server_ = rclcpp_action::create_server<Sleep>(
-      this,
-      "sleep_service",
-      std::bind(&SleepActionServer::handle_goal, this, _1, _2),
-      std::bind(&SleepActionServer::handle_cancel, this, _1),
-      std::bind(&SleepActionServer::handle_accepted, this, _1));
+    threads_ = declare_parameter<int>("threads", 0);
+    accept_latency_ = std::chrono::milliseconds(declare_parameter<int>("accept_latency_ms", 0));
+    const double feedback_rate = declare_parameter<double>("feedback_rate", 5.0);
+    feedback_period_ = (feedback_rate > 0) ?
+      std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / feedback_rate)) :
+      Clock::duration::zero();
+    result_latency_ms_ = declare_parameter<int>("result_latency_ms", -1);
+    reject_probability_ = declare_parameter<double>("reject_probability", 0.0);
+    abort_probability_ = declare_parameter<double>("abort_probability", 0.0);
+    service_latency_ = std::chrono::milliseconds(declare_parameter<int>("service_latency_ms", 0));
+    verbose_ = declare_parameter<bool>("verbose", false);
+    const double stats_period = declare_parameter<double>("stats_period_s", 5.0);
+
+    const auto action_names = declare_parameter<std::vector<std::string>>(
+      "action_names", std::vector<std::string>{"sleep_service"});
+    const auto service_names = declare_parameter<std::vector<std::string>>(
+      "service_names", std::vector<std::string>{});
+
+    // the callbacks of the servers don't block, unless accept_latency_ms is used
+    callback_group_ = create_callback_group(rclcpp::CallbackGroupType::Reentrant);
+
+    for(const auto& action_name: action_names)
+    {
+      action_servers_.push_back(rclcpp_action::create_server<Sleep>(
+        this,
+        action_name,
+        std::bind(&SleepActionServer::handle_goal, this, _1, _2),
+        std::bind(&SleepActionServer::handle_cancel, this, _1),
+        std::bind(&SleepActionServer::handle_accepted, this, _1),
+        rcl_action_server_get_default_options(),
+        callback_group_));
+    }
+    for(const auto& service_name: service_names)
+    {
+      services_.push_back(create_service<Trigger>(
+        service_name,
+        [this, index = services_.size()](const std::shared_ptr<rmw_request_id_t> header,
+                                         const std::shared_ptr<Trigger::Request> request) {
+          handle_request(index, header, request);
+        },
+        rclcpp::ServicesQoS(),
+        callback_group_));
+    }
+    RCLCPP_INFO(get_logger(), "Mock server with %zu action servers and %zu services",
+                action_servers_.size(), services_.size());
+
+    if(stats_period > 0)
+    {
+      stats_timer_ = create_wall_timer(std::chrono::duration<double>(stats_period),
+                                       [this]() { printStatistics(); });
+    }
   }
 
+  ~SleepActionServer()
+  {
+    // the events still scheduled are ignored
+    callback_guard_.release();
+  }
+
+  int threads() const { return threads_; }
+
 private:
-  rclcpp_action::Server<Sleep>::SharedPtr action_server_;
+  struct ActiveGoal
+  {
+    std::shared_ptr<GoalHandleSleep> handle;
+    Clock::time_point deadline;
+    bool abort = false;
+    int cycle = 0;
+    // accessed only by the thread of the scheduler
+    bool finished = false;
+  };
+
+  int threads_;
+  std::chrono::milliseconds accept_latency_;
+  Clock::duration feedback_period_;
+  int result_latency_ms_;
+  double reject_probability_;
+  double abort_probability_;
+  std::chrono::milliseconds service_latency_;
+  bool verbose_;
+
+  std::mutex random_mutex_;
+  std::mt19937 random_engine_{std::random_device{}()};
+
+  std::atomic<uint64_t> active_{0};
+  std::atomic<uint64_t> accepted_{0};
+  std::atomic<uint64_t> rejected_{0};
+  std::atomic<uint64_t> succeeded_{0};
+  std::atomic<uint64_t> aborted_{0};
+  std::atomic<uint64_t> canceled_{0};
+  std::atomic<uint64_t> requests_{0};
+
+  rclcpp::CallbackGroup::SharedPtr callback_group_;
+  std::vector<rclcpp_action::Server<Sleep>::SharedPtr> action_servers_;
+  std::vector<rclcpp::Service<Trigger>::SharedPtr> services_;
+  rclcpp::TimerBase::SharedPtr stats_timer_;
+  BT::CallbackGuard callback_guard_;
+
+  /// The events of all the goals and requests are executed by a single thread, in order of time.
+  void schedule(Clock::time_point when, std::function<void()> callback)
+  {
+    BT::DeadlineScheduler::instance().schedule(when,
+      [token = callback_guard_.token(), callback = std::move(callback)]() {
+        auto lock = token.lock();
+        if(lock) {
+          callback();
+        }
+      });
+  }
+
+  bool randomEvent(double probability)
+  {
+    if(probability <= 0.0)
+    {
+      return false;
+    }
+    std::unique_lock lk(random_mutex_);
+    return std::bernoulli_distribution(probability)(random_engine_);
+  }
 
   rclcpp_action::GoalResponse handle_goal(
     const rclcpp_action::GoalUUID &,
     std::shared_ptr<const Sleep::Goal> goal)
   {
-    RCLCPP_INFO(this->get_logger(), "Received goal request with sleep time %d", goal->msec_timeout);
+    if(verbose_)
+    {
+      RCLCPP_INFO(this->get_logger(), "Received goal request with sleep time %d", goal->msec_timeout);
+    }
+    if(accept_latency_.count() > 0)
+    {
+      std::this_thread::sleep_for(accept_latency_);
+    }
+    if(randomEvent(reject_probability_))
+    {
+      rejected_++;
+      return rclcpp_action::GoalResponse::REJECT;
+    }
     return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
   }
 
   rclcpp_action::CancelResponse handle_cancel(
-    const std::shared_ptr<GoalHandleSleep> goal_handle)
+    const std::shared_ptr<GoalHandleSleep>)
   {
-    RCLCPP_INFO(this->get_logger(), "Received request to cancel goal");
-    (void)goal_handle;
+    if(verbose_)
+    {
+      RCLCPP_INFO(this->get_logger(), "Received request to cancel goal");
+    }
     return rclcpp_action::CancelResponse::ACCEPT;
   }
 
   void handle_accepted(const std::shared_ptr<GoalHandleSleep> goal_handle)
   {
-    using namespace std::placeholders;
-    // this needs to return quickly to avoid blocking the executor, so spin up a new thread
-    std::thread{std::bind(&SleepActionServer::execute, this, _1), goal_handle}.detach();
+    accepted_++;
+    active_++;
+    const auto now = Clock::now();
+    const int duration_ms = (result_latency_ms_ >= 0) ? result_latency_ms_ : goal_handle->get_goal()->msec_timeout;
+
+    auto goal = std::make_shared<ActiveGoal>();
+    goal->handle = goal_handle;
+    goal->deadline = now + std::chrono::milliseconds(duration_ms);
+    goal->abort = randomEvent(abort_probability_);
+
+    // the first feedback is published immediately, as in the original server
+    schedule(now, [this, goal]() { step(goal); });
   }
 
-  void execute(const std::shared_ptr<GoalHandleSleep> goal_handle)
+  // executed by the scheduler: feedback, cancellation or completion of the goal
+  void step(const std::shared_ptr<ActiveGoal>& goal)
   {
-    RCLCPP_INFO(this->get_logger(), "Executing goal");
-    rclcpp::Rate loop_rate(5);
-    const auto goal = goal_handle->get_goal();
-    auto feedback = std::make_shared<Sleep::Feedback>();
+    if(goal->finished)
+    {
+      return;
+    }
     auto result = std::make_shared<Sleep::Result>();
-
-    rclcpp::Time deadline = get_clock()->now() + rclcpp::Duration::from_seconds( double(goal->msec_timeout) / 1000 );
-    int cycle = 0;
-
-    while( get_clock()->now() < deadline )
+    if(goal->handle->is_canceling())
+    {
+      result->done = false;
+      finish(goal, [&]() { goal->handle->canceled(result); }, canceled_, "canceled");
+      return;
+    }
+    const auto now = Clock::now();
+    if(now >= goal->deadline || !rclcpp::ok())
     {
-      if (goal_handle->is_canceling())
+      if(goal->abort)
       {
         result->done = false;
-        goal_handle->canceled(result);
-        RCLCPP_INFO(this->get_logger(), "Goal canceled");
-        return;
+        finish(goal, [&]() { goal->handle->abort(result); }, aborted_, "aborted");
       }
+      else {
+        result->done = true;
+        finish(goal, [&]() { goal->handle->succeed(result); }, succeeded_, "succeeded");
+      }
+      return;
+    }
 
-      feedback->cycle = cycle++;
-      goal_handle->publish_feedback(feedback);
-      RCLCPP_INFO(this->get_logger(), "Publish feedback");
+    auto next = goal->deadline;
+    if(feedback_period_.count() > 0)
+    {
+      auto feedback = std::make_shared<Sleep::Feedback>();
+      feedback->cycle = goal->cycle++;
+      goal->handle->publish_feedback(feedback);
+      if(verbose_)
+      {
+        RCLCPP_INFO(this->get_logger(), "Publish feedback");
+      }
+      next = std::min(next, now + feedback_period_);
+    }
+    else {
+      // without feedback, the cancel requests are still checked periodically
+      next = std::min(next, now + std::chrono::milliseconds(100));
+    }
+    schedule(next, [this, goal]() { step(goal); });
+  }
 
-      loop_rate.sleep();
+  template<class Func>
+  void finish(const std::shared_ptr<ActiveGoal>& goal, Func&& func,
+              std::atomic<uint64_t>& counter, const char* what)
+  {
+    goal->finished = true;
+    if(rclcpp::ok())
+    {
+      func();
     }
+    counter++;
+    active_--;
+    if(verbose_)
+    {
+      RCLCPP_INFO(this->get_logger(), "Goal %s", what);
+    }
+  }
 
-    // Check if goal is done
-    if (rclcpp::ok())
+  void handle_request(size_t index,
+                      const std::shared_ptr<rmw_request_id_t> header,
+                      const std::shared_ptr<Trigger::Request>)
+  {
+    requests_++;
+    auto response = std::make_shared<Trigger::Response>();
+    response->success = !randomEvent(reject_probability_);
+    if(verbose_)
     {
-      result->done = true;
-      goal_handle->succeed(result);
-      RCLCPP_INFO(this->get_logger(), "Goal succeeded");
+      RCLCPP_INFO(this->get_logger(), "Request received by %s", services_[index]->get_service_name());
     }
+
+    // the response is sent later, without blocking the executor
+    auto service = services_[index];
+    auto send = [service, header, response]() {
+      if(rclcpp::ok())
+      {
+        service->send_response(*header, *response);
+      }
+    };
+    if(service_latency_.count() > 0)
+    {
+      schedule(Clock::now() + service_latency_, send);
+    }
+    else {
+      send();
+    }
+  }
+
+  void printStatistics()
+  {
+    RCLCPP_INFO(get_logger(), "goals: active %lu, accepted %lu, rejected %lu, succeeded %lu, "
+                "aborted %lu, canceled %lu; service requests %lu",
+                active_.load(), accepted_.load(), rejected_.load(), succeeded_.load(),
+                aborted_.load(), canceled_.load(), requests_.load());
   }
 };  // class SleepActionServer
 
@@ -97,7 +334,12 @@ int main(int argc, char** argv)
   rclcpp::init(argc, argv);
   auto node = std::make_shared<SleepActionServer>();
 
-  rclcpp::spin(node);
+  // 0: the number of hardware threads
+  rclcpp::executors::MultiThreadedExecutor executor(rclcpp::ExecutorOptions(),
+                                                    size_t(std::max(0, node->threads())));
+  executor.add_node(node);
+  executor.spin();
 
+  rclcpp::shutdown();
   return 0;
 }
@@ -0,0 +1,221 @@
+// Copyright (c) 2023 Davide Faconti
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The thread of the tree must not allocate memory while ticking RUNNING
+// RosActionNodes with RosNodeParams::realtime, after the warm-up.
+// It is the same check of BM_ActionTickRealtime in bt_ros2_benchmark,
+// that is built only on demand.
+
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <rclcpp/rclcpp.hpp>
+#include <rclcpp_action/rclcpp_action.hpp>
+
+#include "behaviortree_cpp/bt_factory.h"
+#include "behaviortree_ros2/action/sleep.hpp"
+#include "behaviortree_ros2/bt_action_node.hpp"
+#include "behaviortree_ros2/ros_background_executor.hpp"
+#include "behaviortree_ros2/ros_log_ring.hpp"
+
+// allocations of the current thread only
+static thread_local uint64_t thread_allocations_count = 0;
+
+void* operator new(std::size_t size)
+{
+  thread_allocations_count++;
+  if(void* ptr = std::malloc(size > 0 ? size : 1))
+  {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+using namespace BT;
+using Sleep = behaviortree_ros2::action::Sleep;
+
+// accepts all the goals; they publish feedback, and complete only when cancelled
+class NeverEndingServer : public rclcpp::Node
+{
+public:
+  using GoalHandleSleep = rclcpp_action::ServerGoalHandle<Sleep>;
+
+  NeverEndingServer() : Node("test_realtime_tick_server")
+  {
+    action_server_ = rclcpp_action::create_server<Sleep>(
+      this, "test_realtime_sleep",
+      [](const rclcpp_action::GoalUUID&, std::shared_ptr<const Sleep::Goal>) {
+        return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
+      },
+      [](const std::shared_ptr<GoalHandleSleep>) {
+        return rclcpp_action::CancelResponse::ACCEPT;
+      },
+      [this](const std::shared_ptr<GoalHandleSleep> goal_handle) {
+        std::unique_lock lk(mutex_);
+        running_goals_.push_back(goal_handle);
+      });
+
+    step_timer_ = create_wall_timer(std::chrono::milliseconds(5), [this]() {
+      std::unique_lock lk(mutex_);
+      for(auto it = running_goals_.begin(); it != running_goals_.end(); )
+      {
+        if((*it)->is_canceling())
+        {
+          (*it)->canceled(std::make_shared<Sleep::Result>());
+          it = running_goals_.erase(it);
+        }
+        else {
+          (*it)->publish_feedback(std::make_shared<Sleep::Feedback>());
+          it++;
+        }
+      }
+    });
+  }
+
+  size_t runningGoals()
+  {
+    std::unique_lock lk(mutex_);
+    return running_goals_.size();
+  }
+
+private:
+  std::mutex mutex_;
+  rclcpp_action::Server<Sleep>::SharedPtr action_server_;
+  std::vector<std::shared_ptr<GoalHandleSleep>> running_goals_;
+  rclcpp::TimerBase::SharedPtr step_timer_;
+};
+
+// written by the thread of the tree only
+static int nodes_with_feedback = 0;
+static uint64_t feedback_count = 0;
+
+class RealtimeSleep : public RosActionNode<Sleep>
+{
+public:
+  RealtimeSleep(const std::string& name, const NodeConfig& conf, const RosNodeParams& params)
+    : RosActionNode<Sleep>(name, conf, params)
+  {}
+
+  bool setGoal(Goal& goal) override
+  {
+    goal.msec_timeout = 1000000;
+    return true;
+  }
+
+  NodeStatus onResultReceived(const WrappedResult& wr) override
+  {
+    return wr.result->done ? NodeStatus::SUCCESS : NodeStatus::FAILURE;
+  }
+
+  // invoked by tick(), only for the feedback of the current goal
+  NodeStatus onFeedback(const std::shared_ptr<const Feedback>) override
+  {
+    if(!got_feedback_)
+    {
+      got_feedback_ = true;
+      nodes_with_feedback++;
+    }
+    feedback_count++;
+    return NodeStatus::RUNNING;
+  }
+
+private:
+  bool got_feedback_ = false;
+};
+
+TEST(RealtimeTick, NoAllocationsWhileRunning)
+{
+  constexpr size_t kNumNodes = 8;
+  auto server = std::make_shared<NeverEndingServer>();
+  rclcpp::executors::SingleThreadedExecutor server_executor;
+  server_executor.add_node(server);
+  std::thread server_thread([&]() { server_executor.spin(); });
+
+  {
+    RosNodeParams params;
+    params.nh = std::make_shared<rclcpp::Node>("test_realtime_tick_client");
+    params.default_port_value = "test_realtime_sleep";
+    params.server_timeout = std::chrono::seconds(10);
+    params.background_executor = std::make_shared<RosBackgroundExecutor>();
+    params.log_ring = std::make_shared<RosLogRing>();
+    params.realtime = true;
+
+    BehaviorTreeFactory factory;
+    factory.registerNodeType<RealtimeSleep>("RealtimeSleep", params);
+
+    std::ostringstream xml;
+    xml << R"(<root BTCPP_format="4"><BehaviorTree ID="Main">)"
+        << R"(<Parallel success_count="-1" failure_count="1">)";
+    for(size_t i = 0; i < kNumNodes; i++)
+    {
+      xml << "<RealtimeSleep/>";
+    }
+    xml << "</Parallel></BehaviorTree></root>";
+    auto tree = factory.createTreeFromText(xml.str());
+
+    // until all the goals are accepted by the server, and every Node received the
+    // response and processed a feedback of its goal
+    const auto warm_up_timeout = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while(server->runningGoals() < kNumNodes || nodes_with_feedback < int(kNumNodes))
+    {
+      ASSERT_LT(std::chrono::steady_clock::now(), warm_up_timeout) << "the goals were not accepted";
+      ASSERT_EQ(tree.tickOnce(), NodeStatus::RUNNING);
+      tree.sleep(std::chrono::milliseconds(1));
+    }
+
+    // the ticks are woken up by the feedback, that goes through the code under test;
+    // only the allocations of tickOnce() are counted
+    const uint64_t feedback_before = feedback_count;
+    uint64_t allocations = 0;
+    for(int i = 0; i < 200; i++)
+    {
+      tree.sleep(std::chrono::milliseconds(20));
+      const uint64_t before = thread_allocations_count;
+      const NodeStatus status = tree.tickOnce();
+      allocations += thread_allocations_count - before;
+      ASSERT_EQ(status, NodeStatus::RUNNING);
+    }
+    EXPECT_GT(feedback_count, feedback_before) << "no feedback was processed while measuring";
+    EXPECT_EQ(allocations, 0u);
+    tree.haltTree();
+  }
+
+  server_executor.cancel();
+  server_thread.join();
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  rclcpp::init(argc, argv);
+  const int ret = RUN_ALL_TESTS();
+  rclcpp::shutdown();
+  return ret;
+}